@@ -0,0 +1,190 @@
+#ifndef ARENA_HH
+#define ARENA_HH
+
+#include "instrument.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+
+using namespace std;
+
+// Thread-local bump allocator for the short-lived temporaries of one candidate graph (bit
+// vectors of g6 codes, canonicalizer work arrays, ...). Allocation is a pointer bump in the
+// current block; nothing is freed individually. An ArenaScope releases everything allocated on
+// the thread's arena since it was opened, e.g. once per candidate, and the blocks are reused by
+// the next candidate, so the hot loops stop going through malloc. When the outermost scope
+// closes, blocks larger than block_size (made for single large requests) are freed.
+class Arena {
+    public:
+        static constexpr size_t block_size = 64 << 10;
+
+        struct Marker {
+            size_t block;
+            size_t offset;
+        };
+
+        void* allocate(size_t n, size_t align) {
+            while (true) {
+                if (current < blocks.size()) {
+                    Block& b = blocks[current];
+                    size_t start = (offset + align - 1) & ~(align - 1);
+                    if (start + n <= b.size) {
+                        offset = start + n;
+                        ++num_allocations;
+                        num_bytes += n;
+                        return b.data.get() + start;
+                    }
+                    if (current + 1 < blocks.size() && blocks[current + 1].size >= n + align) {
+                        ++current;
+                        offset = 0;
+                        continue;
+                    }
+                }
+                // a new block after the current one; larger requests get a block of their own
+                size_t size = std::max(block_size, n + align);
+                Block b{std::unique_ptr<char[]>(new char[size]), size};
+                size_t pos = current < blocks.size() ? current + 1 : blocks.size();
+                blocks.insert(blocks.begin() + pos, std::move(b));
+                current = pos;
+                offset = 0;
+            }
+        }
+
+        bool owns(const void* p) const {
+            return find_block(p) < blocks.size();
+        }
+
+        // Whether p is in the part allocated since the outermost open scope, i.e. not released.
+        bool live(const void* p) const {
+            size_t b = find_block(p);
+            if (b == blocks.size()) return false;
+            return b < current || (b == current && static_cast<size_t>(static_cast<const char*>(p) - blocks[b].data.get()) < offset);
+        }
+
+        Marker mark() const {
+            return {current, offset};
+        }
+
+        void release(Marker m) {
+            current = m.block;
+            offset = m.offset;
+        }
+
+        // Free the oversized blocks; nothing may be allocated.
+        void trim() {
+            blocks.erase(std::remove_if(blocks.begin(), blocks.end(), [](const Block& b) { return b.size > block_size; }),
+                         blocks.end());
+            current = 0;
+            offset = 0;
+        }
+
+        bool in_scope() const {
+            return depth > 0;
+        }
+
+        uint64_t num_allocations = 0;
+        uint64_t num_bytes = 0;
+        unsigned depth = 0;
+
+    private:
+        struct Block {
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+
+        std::vector<Block> blocks;
+        size_t current = 0;
+        size_t offset = 0;
+
+        size_t find_block(const void* p) const {
+            auto c = static_cast<const char*>(p);
+            for (size_t i = 0; i < blocks.size(); ++i) {
+                if (c >= blocks[i].data.get() && c < blocks[i].data.get() + blocks[i].size) return i;
+            }
+            return blocks.size();
+        }
+};
+
+inline Arena& thread_arena() {
+    thread_local Arena arena;
+    return arena;
+}
+
+// Releases the allocations made on this thread's arena while it was open, and counts them in the
+// instrumentation (per candidate, if opened once per candidate). Scopes nest.
+class ArenaScope {
+    public:
+        ArenaScope() : arena(thread_arena()), marker(arena.mark()),
+                       allocations(arena.num_allocations), bytes(arena.num_bytes) {
+            ++arena.depth;
+        }
+
+        ~ArenaScope() {
+            --arena.depth;
+            if (arena.depth == 0) {
+                INSTR_COUNT(ArenaScopes, 1);
+                INSTR_COUNT(ArenaAllocations, arena.num_allocations - allocations);
+                INSTR_COUNT(ArenaBytes, arena.num_bytes - bytes);
+            }
+            arena.release(marker);
+            if (arena.depth == 0) arena.trim();
+        }
+
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+
+    private:
+        Arena& arena;
+        Arena::Marker marker;
+        uint64_t allocations;
+        uint64_t bytes;
+};
+
+// Standard allocator on the thread's arena, for scratch locals of the kernels only: a container
+// using it must be created and destroyed on one thread within the same innermost ArenaScope, or
+// both outside of any scope, where it falls back to the heap. Whether memory came from the heap
+// is told by the scope depth at deallocation, so it is O(1). Build with -DGGEN_ARENA_CHECK
+// (make ARENA_CHECK=1) to abort on containers that cross a scope boundary.
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+
+    ArenaAllocator() noexcept = default;
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        Arena& arena = thread_arena();
+        if (!arena.in_scope()) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(arena.allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        Arena& arena = thread_arena();
+#ifdef GGEN_ARENA_CHECK
+        if (arena.in_scope() ? !arena.live(p) : arena.owns(p)) {
+            std::fprintf(stderr, "ArenaAllocator: memory freed across an ArenaScope boundary\n");
+            std::abort();
+        }
+#endif
+        if (!arena.in_scope()) ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>&) const noexcept { return true; }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U>&) const noexcept { return false; }
+};
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif // ARENA_HH
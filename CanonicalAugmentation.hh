@@ -0,0 +1,136 @@
+#ifndef CANONICALAUGMENTATION_HH
+#define CANONICALAUGMENTATION_HH
+
+#include "mygraphs.hh"
+#include "parallel.hh"
+#include "progress.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Generation by canonical construction path (McKay, "Isomorph-free exhaustive generation").
+//
+// Every graph G of a family is built from a parent by an augmentation; the inverse operation, a
+// reduction of G, is a small vertex configuration of G (an edge to remove, a vertex to split, ...).
+// Among all reductions of G one is chosen canonically: the one whose image under the canonical
+// labeling of G is smallest. A child is accepted only if the reduction that undoes its
+// augmentation is in the same Aut(G)-orbit as the canonical one. Then every isomorphism class
+// comes from exactly one parent, and only from augmentations of that parent that are equivalent
+// under Aut(parent), so no global dedup set is needed.
+
+// A reduction of a graph: a type tag and lists of vertices. Each part is a set of vertices; the
+// parts after the first are unordered among themselves (e.g. the two sides of a vertex split).
+struct Reduction {
+    uint8_t type = 0;
+    vector<vector<uint8_t>> parts;
+
+    Reduction() = default;
+
+    Reduction(uint8_t type_, vector<vector<uint8_t>> parts_)
+        : type(type_), parts(std::move(parts_)) {
+        normalize();
+    }
+
+    // Image under the vertex permutation p (p[v] is the image of v).
+    template <typename Perm>
+    Reduction mapped(const Perm& p) const {
+        Reduction r;
+        r.type = type;
+        r.parts = parts;
+        for (auto& part : r.parts) {
+            for (auto& v : part) v = p[v];
+        }
+        r.normalize();
+        return r;
+    }
+
+    bool operator<(const Reduction& o) const {
+        return type != o.type ? type < o.type : parts < o.parts;
+    }
+
+    bool operator==(const Reduction& o) const {
+        return type == o.type && parts == o.parts;
+    }
+
+    private:
+        void normalize() {
+            for (auto& part : parts) std::sort(part.begin(), part.end());
+            if (parts.size() > 2) std::sort(parts.begin() + 1, parts.end());
+        }
+};
+
+// Canonical labeling and automorphism group generators of a graph, from one search.
+struct GraphSymmetry {
+    vector<uint8_t> labels;
+    vector<vector<uint8_t>> generators;
+};
+
+inline GraphSymmetry graph_symmetry(const Graph& G) {
+    GraphSymmetry sym;
+    sym.labels = G.search_automorphisms({}, true, [&](unsigned n, const unsigned* perm) {
+        INSTR_COUNT(AutomorphismGenerators, 1);
+        sym.generators.emplace_back(perm, perm + n);
+    });
+    return sym;
+}
+
+// Whether r is in the Aut(G)-orbit of the canonical reduction among all (which contains r).
+inline bool is_canonical_reduction(const Reduction& r, const vector<Reduction>& all, const GraphSymmetry& sym) {
+    if (all.empty()) throw std::logic_error("Graph without reductions");
+    Reduction best = all[0].mapped(sym.labels);
+    for (size_t i = 1; i < all.size(); ++i) {
+        Reduction c = all[i].mapped(sym.labels);
+        if (c < best) best = std::move(c);
+    }
+    // walk the orbit of r under the generators
+    set<Reduction> orbit{r};
+    vector<Reduction> todo{r};
+    while (!todo.empty()) {
+        Reduction cur = std::move(todo.back());
+        todo.pop_back();
+        if (cur.mapped(sym.labels) == best) return true;
+        for (const auto& g : sym.generators) {
+            Reduction img = cur.mapped(g);
+            if (orbit.insert(img).second) todo.push_back(std::move(img));
+        }
+    }
+    return false;
+}
+
+// Parallel generation engine, the canonical augmentation counterpart of collect_canonical_g6.
+// generate(i, emit) is called once for every parent i in [0, n) and passes its children to
+// emit(G, r), r being the reduction of G that undoes the augmentation. reductions_of(G) lists all
+// reductions of G whose parents are in the parent lists. Accepted children are canonicalized; the
+// only duplicates left are children of one parent by augmentations equivalent under its
+// automorphisms, which are removed per parent before the children go to the list of the calling
+// thread in found. found.finish() then gives the sorted canonical codes, and fails if a graph was
+// produced from two parents, i.e. if the reductions do not match the augmentations.
+template <typename Generate, typename Reductions>
+void collect_orderly_g6(size_t n, const string& label, Generate&& generate, Reductions&& reductions_of,
+                        G6DistinctSet& found) {
+    ProgressReporter progress(label, n);
+    parallel_for(n, [&](size_t i, unsigned tid) {
+        vector<string> children;
+        generate(i, [&](const Graph& G, const Reduction& r) {
+            ArenaScope scope;
+            GraphSymmetry sym = graph_symmetry(G);
+            if (!is_canonical_reduction(r, reductions_of(G), sym)) return;
+            Graph canonG(G.num_vertices, G.edges);
+            canonG.relabel(sym.labels);
+            children.push_back(canonG.to_g6());
+        });
+        std::sort(children.begin(), children.end());
+        children.erase(std::unique(children.begin(), children.end()), children.end());
+        for (auto& g6 : children) found.insert(tid, std::move(g6));
+        progress.inc();
+    });
+    progress.finish();
+}
+
+#endif // CANONICALAUGMENTATION_HH
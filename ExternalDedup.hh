@@ -0,0 +1,376 @@
+#ifndef EXTERNALDEDUP_HH
+#define EXTERNALDEDUP_HH
+
+#include "instrument.hh"
+#include "parallel.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+// Memory budget in bytes for the dedup sets of a build, e.g. for --mem-budget; 0 means no limit.
+inline size_t mem_budget_setting = 0;
+
+// Sorted list of distinct g6 codes: in memory, or in a temporary file with one code per line,
+// which is removed together with the list.
+class SortedG6List {
+    public:
+        SortedG6List() = default;
+
+        SortedG6List(vector<string> records_) : records(std::move(records_)), count(records.size()) {}
+
+        static SortedG6List from_file(const string& path, size_t count) {
+            SortedG6List list;
+            list.path = path;
+            list.count = count;
+            return list;
+        }
+
+        SortedG6List(SortedG6List&& other) noexcept
+            : records(std::move(other.records)), path(std::exchange(other.path, "")), count(std::exchange(other.count, 0)) {}
+
+        SortedG6List& operator=(SortedG6List&& other) noexcept {
+            if (this != &other) {
+                remove_file();
+                records = std::move(other.records);
+                path = std::exchange(other.path, "");
+                count = std::exchange(other.count, 0);
+            }
+            return *this;
+        }
+
+        SortedG6List(const SortedG6List&) = delete;
+        SortedG6List& operator=(const SortedG6List&) = delete;
+
+        ~SortedG6List() {
+            remove_file();
+        }
+
+        size_t size() const { return count; }
+        bool in_memory() const { return path.empty(); }
+        const vector<string>& get_records() const { return records; }
+
+        // Pass the codes, in order, to f(string_view).
+        template <typename F>
+        void for_each(F&& f) const {
+            if (in_memory()) {
+                for (const auto& g6 : records) f(string_view(g6));
+                return;
+            }
+            INSTR_SCOPE(IO);
+            ifstream file(path);
+            if (!file) throw std::runtime_error("Failed to open file for reading: " + path);
+            string line;
+            size_t n = 0;
+            while (std::getline(file, line)) {
+                f(string_view(line));
+                ++n;
+            }
+            if (n != count) throw std::runtime_error("Spilled list " + path + " is truncated");
+        }
+
+    private:
+        vector<string> records;
+        string path;
+        size_t count = 0;
+
+        void remove_file() {
+            if (!path.empty()) std::remove(path.c_str());
+            path.clear();
+        }
+};
+
+// Sorted runs of g6 codes in temporary files <spill_prefix>.run<k>.<pid>, one code per line, and
+// their k-way merge into a single sorted file; the merge holds one code per run in memory. Run
+// files still held are removed with the object.
+class G6SpillRuns {
+    public:
+        // runs merged at once; more runs are merged in several rounds
+        static constexpr size_t max_merge_fanout = 64;
+
+        explicit G6SpillRuns(const string& spill_prefix_) : spill_prefix(spill_prefix_) {}
+
+        ~G6SpillRuns() {
+            for (const auto& run : runs) std::remove(run.path.c_str());
+        }
+
+        G6SpillRuns(const G6SpillRuns&) = delete;
+        G6SpillRuns& operator=(const G6SpillRuns&) = delete;
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mtx);
+            return runs.size();
+        }
+
+        // Write the sorted codes g6s as a new run; may be called by several threads at once.
+        void write(const vector<string>& g6s) {
+            INSTR_SCOPE(IO);
+            INSTR_COUNT(DedupSpills, 1);
+            Run run{new_run_path(), g6s.size()};
+            try {
+                ofstream out(run.path);
+                for (const auto& g6 : g6s) {
+                    out.write(g6.data(), g6.size());
+                    out.put('\n');
+                }
+                if (!out) throw std::runtime_error("Failed to write spill file " + run.path);
+            } catch (...) {
+                std::remove(run.path.c_str());
+                throw;
+            }
+            std::lock_guard<std::mutex> lock(mtx);
+            runs.push_back(std::move(run));
+        }
+
+        // Merge all runs, dropping duplicates, into one sorted file, and remove them. With distinct
+        // set, a code in two runs is an error instead (see duplicate_error).
+        SortedG6List merge(bool distinct) {
+            cout << "Merging " << runs.size() << " spilled runs" << endl;
+            while (runs.size() > 1) {
+                // merge the first max_merge_fanout runs into a new one at the end; they stay in
+                // runs, and so are removed with this object, until the merge succeeded
+                size_t k = std::min(runs.size(), max_merge_fanout);
+                vector<Run> group(runs.begin(), runs.begin() + k);
+                Run merged = merge_runs(group, distinct);
+                runs.erase(runs.begin(), runs.begin() + k);
+                // no reallocation, k > 1 runs were just erased
+                runs.push_back(std::move(merged));
+                for (const auto& in : group) std::remove(in.path.c_str());
+            }
+            Run result = runs.back();
+            runs.clear();
+            return SortedG6List::from_file(result.path, result.count);
+        }
+
+        static std::runtime_error duplicate_error(const string& g6) {
+            return std::runtime_error("Code " + g6 + " was inserted twice into a set of distinct codes");
+        }
+
+    private:
+        struct Run {
+            string path;
+            size_t count;
+        };
+
+        // shared by all sets, which may spill next to the same output
+        static inline std::atomic<size_t> next_run{0};
+
+        string spill_prefix;
+        mutable std::mutex mtx;
+        vector<Run> runs;
+
+        string new_run_path() {
+            return spill_prefix + ".run" + std::to_string(next_run++) + "." + std::to_string(::getpid());
+        }
+
+        // Merge sorted runs into a new run without duplicates; the inputs are left alone.
+        Run merge_runs(const vector<Run>& inputs, bool distinct) {
+            INSTR_SCOPE(IO);
+            Run run{new_run_path(), 0};
+            try {
+                vector<ifstream> files;
+                files.reserve(inputs.size());
+                vector<string> heads(inputs.size());
+                auto later = [&](size_t a, size_t b) { return heads[a] > heads[b]; };
+                priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+                for (size_t i = 0; i < inputs.size(); ++i) {
+                    files.emplace_back(inputs[i].path);
+                    if (!files.back()) throw std::runtime_error("Failed to open spill file " + inputs[i].path);
+                    if (std::getline(files[i], heads[i])) heap.push(i);
+                }
+                ofstream out(run.path);
+                string last;
+                while (!heap.empty()) {
+                    size_t i = heap.top();
+                    heap.pop();
+                    if (run.count == 0 || heads[i] != last) {
+                        out.write(heads[i].data(), heads[i].size());
+                        out.put('\n');
+                        last = heads[i];
+                        ++run.count;
+                    } else if (distinct) {
+                        throw duplicate_error(heads[i]);
+                    }
+                    if (std::getline(files[i], heads[i])) heap.push(i);
+                }
+                if (!out) throw std::runtime_error("Failed to write spill file " + run.path);
+            } catch (...) {
+                std::remove(run.path.c_str());
+                throw;
+            }
+            return run;
+        }
+};
+
+// Per-thread hash sets of g6 codes for the parallel build engines. Without a memory budget this
+// is plain in-memory dedup. With one, a thread whose set outgrows its share of the budget sorts
+// the set and spills it as a run (see G6SpillRuns), and finish() merges the runs k-way, dropping
+// duplicates, into a single sorted file. The memory estimate counts the codes plus a fixed
+// overhead per hash set entry.
+class G6DedupSet {
+    public:
+        // hash node, bucket and string header of an entry, roughly
+        static constexpr size_t entry_overhead = 64;
+
+        explicit G6DedupSet(const string& spill_prefix, size_t budget_ = mem_budget_setting)
+            : budget(budget_), tables(parallel_num_threads()), runs(spill_prefix) {}
+
+        G6DedupSet(const G6DedupSet&) = delete;
+        G6DedupSet& operator=(const G6DedupSet&) = delete;
+
+        // Insert g6 into the set of thread tid; threads must use distinct tids.
+        void insert(unsigned tid, string g6) {
+            Table& t = tables[tid];
+            size_t bytes = g6.size() + entry_overhead;
+            if (!t.set.insert(std::move(g6)).second) return;
+            t.bytes += bytes;
+            if (budget > 0 && t.bytes > budget / tables.size()) spill(t);
+        }
+
+        // Number of runs spilled so far.
+        size_t num_runs() const {
+            return runs.size();
+        }
+
+        // The sorted distinct codes inserted by all threads; empties the set. In memory if
+        // nothing was spilled.
+        SortedG6List finish() {
+            if (runs.size() == 0) {
+                vector<string> g6s;
+                for (auto& t : tables) {
+                    g6s.reserve(g6s.size() + t.set.size());
+                    while (!t.set.empty()) g6s.push_back(std::move(t.set.extract(t.set.begin()).value()));
+                    unordered_set<string>().swap(t.set);
+                    t.bytes = 0;
+                }
+                std::sort(g6s.begin(), g6s.end());
+                g6s.erase(std::unique(g6s.begin(), g6s.end()), g6s.end());
+                return SortedG6List(std::move(g6s));
+            }
+            for (auto& t : tables) {
+                if (!t.set.empty()) spill(t);
+            }
+            return runs.merge(false);
+        }
+
+    private:
+        struct Table {
+            unordered_set<string> set;
+            size_t bytes = 0;
+        };
+
+        size_t budget;
+        vector<Table> tables;
+        G6SpillRuns runs;
+
+        void spill(Table& t) {
+            vector<string> g6s;
+            g6s.reserve(t.set.size());
+            while (!t.set.empty()) g6s.push_back(std::move(t.set.extract(t.set.begin()).value()));
+            unordered_set<string>().swap(t.set);
+            t.bytes = 0;
+            std::sort(g6s.begin(), g6s.end());
+            runs.write(g6s);
+        }
+};
+
+// Per-thread lists of g6 codes that are distinct by construction, e.g. the canonical children of
+// canonical augmentation. A code costs only its string: there are no hash sets, and threads share
+// nothing. finish() sorts the lists and merges them k-way; a code inserted twice means the
+// construction is wrong and is an error. Under a memory budget, a thread whose list outgrows its
+// share is sorted and spilled as a run like in G6DedupSet, and finish() merges the runs.
+class G6DistinctSet {
+    public:
+        // string header of an entry
+        static constexpr size_t entry_overhead = sizeof(string);
+
+        explicit G6DistinctSet(const string& spill_prefix, size_t budget_ = mem_budget_setting)
+            : budget(budget_), lists(parallel_num_threads()), runs(spill_prefix) {}
+
+        G6DistinctSet(const G6DistinctSet&) = delete;
+        G6DistinctSet& operator=(const G6DistinctSet&) = delete;
+
+        // Insert g6 into the list of thread tid; threads must use distinct tids.
+        void insert(unsigned tid, string g6) {
+            List& l = lists[tid];
+            l.bytes += g6.size() + entry_overhead;
+            l.codes.push_back(std::move(g6));
+            if (budget > 0 && l.bytes > budget / lists.size()) spill(l);
+        }
+
+        // Number of runs spilled so far.
+        size_t num_runs() const {
+            return runs.size();
+        }
+
+        // The sorted codes inserted by all threads; empties the set. In memory if nothing was
+        // spilled.
+        SortedG6List finish() {
+            if (runs.size() > 0) {
+                for (auto& l : lists) {
+                    if (!l.codes.empty()) spill(l);
+                }
+                return runs.merge(true);
+            }
+            parallel_for(lists.size(), [&](size_t t, unsigned) { std::sort(lists[t].codes.begin(), lists[t].codes.end()); });
+            size_t total = 0;
+            for (const auto& l : lists) total += l.codes.size();
+            vector<string> g6s;
+            g6s.reserve(total);
+            vector<size_t> next(lists.size(), 0);
+            auto later = [&](size_t a, size_t b) { return lists[a].codes[next[a]] > lists[b].codes[next[b]]; };
+            priority_queue<size_t, vector<size_t>, decltype(later)> heap(later);
+            for (size_t t = 0; t < lists.size(); ++t) {
+                if (!lists[t].codes.empty()) heap.push(t);
+            }
+            while (!heap.empty()) {
+                size_t t = heap.top();
+                heap.pop();
+                string& g6 = lists[t].codes[next[t]++];
+                if (!g6s.empty() && g6 == g6s.back()) throw G6SpillRuns::duplicate_error(g6);
+                g6s.push_back(std::move(g6));
+                if (next[t] < lists[t].codes.size()) {
+                    heap.push(t);
+                } else {
+                    vector<string>().swap(lists[t].codes);
+                    lists[t].bytes = 0;
+                }
+            }
+            return SortedG6List(std::move(g6s));
+        }
+
+    private:
+        struct List {
+            vector<string> codes;
+            size_t bytes = 0;
+        };
+
+        size_t budget;
+        vector<List> lists;
+        G6SpillRuns runs;
+
+        void spill(List& l) {
+            std::sort(l.codes.begin(), l.codes.end());
+            auto dup = std::adjacent_find(l.codes.begin(), l.codes.end());
+            if (dup != l.codes.end()) throw G6SpillRuns::duplicate_error(*dup);
+            runs.write(l.codes);
+            vector<string>().swap(l.codes);
+            l.bytes = 0;
+        }
+};
+
+#endif // EXTERNALDEDUP_HH
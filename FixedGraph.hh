@@ -0,0 +1,170 @@
+#ifndef FIXEDGRAPH_HH
+#define FIXEDGRAPH_HH
+
+#include "mygraphs.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Graph kernels specialized on the number of vertices N and edges E: the edges live in std::array
+// storage and all loops have compile time bounds, so the compiler can unroll and vectorize them.
+// The results agree with the generic Graph methods of the same name.
+template <size_t N, size_t E>
+class FixedGraph {
+    public:
+        static_assert(N >= 2 && N <= 62, "graph6 codes support at most 62 vertices");
+
+        // Edges sorted, us[i] < vs[i]; adj[v] is the neighborhood of v as a bit set.
+        std::array<uint8_t, E> us;
+        std::array<uint8_t, E> vs;
+        std::array<uint64_t, N> adj;
+
+        static bool fits(const Graph& G) {
+            return G.num_vertices == N && G.edges.size() == E;
+        }
+
+        explicit FixedGraph(const Graph& G) {
+            std::array<uint16_t, E> keys;
+            for (size_t i = 0; i < E; ++i) {
+                uint8_t a = G.edges[i].u, b = G.edges[i].v;
+                keys[i] = a < b ? (a << 8 | b) : (b << 8 | a);
+            }
+            std::sort(keys.begin(), keys.end());
+            adj.fill(0);
+            for (size_t i = 0; i < E; ++i) {
+                us[i] = keys[i] >> 8;
+                vs[i] = keys[i] & 0xff;
+                adj[us[i]] |= uint64_t(1) << vs[i];
+                adj[vs[i]] |= uint64_t(1) << us[i];
+            }
+        }
+
+        string to_g6() const {
+            INSTR_SCOPE(G6Encoding);
+            constexpr size_t num_bytes = (N * (N - 1) / 2 + 5) / 6;
+            string result(1 + num_bytes, static_cast<char>(63));
+            result[0] = static_cast<char>(N + 63);
+            size_t k = 0;
+            for (size_t j = 1; j < N; ++j) {
+                for (size_t i = 0; i < j; ++i, ++k) {
+                    if ((adj[j] >> i) & 1) result[1 + k / 6] += static_cast<char>(1 << (5 - k % 6));
+                }
+            }
+            return result;
+        }
+
+        int perm_sign(const ScratchPermutation& p, bool even_edges) const {
+            INSTR_SCOPE(SignComputation);
+            int parity = 0;
+            if (even_edges) {
+                // sign of the vertex permutation times the orientation flips
+                for (size_t i = 0; i < N; ++i) {
+                    for (size_t j = i + 1; j < N; ++j) parity ^= p[i] > p[j];
+                }
+                for (size_t i = 0; i < E; ++i) parity ^= p[us[i]] > p[vs[i]];
+            } else {
+                // sign of the induced permutation of the sorted edges
+                std::array<uint16_t, E> img;
+                for (size_t i = 0; i < E; ++i) img[i] = edge_key(p[us[i]], p[vs[i]]);
+                parity = inversion_parity(img, E);
+            }
+            return parity ? -1 : 1;
+        }
+
+        // As Graph::get_contractions_with_sign: for every edge whose contraction leaves a simple
+        // graph, the contracted graph (N - 1 vertices, E - 1 edges) and its sign.
+        vector<pair<Graph, int>> get_contractions_with_sign(bool even_edges) const {
+            INSTR_SCOPE(GraphConstruction);
+            vector<pair<Graph, int>> image;
+            image.reserve(E);
+            for (size_t i = 0; i < E; ++i) {
+                uint8_t u = us[i], v = vs[i];
+                // a common neighbor would give a double edge
+                if (adj[u] & adj[v]) continue;
+                // permute_to_left(u, v), followed by the contraction of (0, 1)
+                std::array<uint8_t, N> pp;
+                std::array<uint8_t, N> m;
+                uint8_t next = 2;
+                for (size_t x = 0; x < N; ++x) {
+                    pp[x] = x == u ? 0 : (x == v ? 1 : next++);
+                    m[x] = pp[x] < 2 ? 0 : pp[x] - 1;
+                }
+                std::array<uint16_t, E - 1> keys;
+                for (size_t j = 0, c = 0; j < E; ++j) {
+                    if (j != i) keys[c++] = edge_key(m[us[j]], m[vs[j]]);
+                }
+                int parity = 0;
+                if (even_edges) {
+                    for (size_t a = 0; a < N; ++a) {
+                        for (size_t b = a + 1; b < N; ++b) parity ^= pp[a] > pp[b];
+                    }
+                    for (size_t j = 0; j < E; ++j) parity ^= pp[us[j]] > pp[vs[j]];
+                    parity ^= 1;
+                } else {
+                    // the contracted edge moves to the front, the others to their sorted position
+                    parity = (i & 1) ^ inversion_parity(keys, E - 1);
+                }
+                std::sort(keys.begin(), keys.end());
+                Graph G1(N - 1);
+                G1.edges.reserve(E - 1);
+                for (size_t j = 0; j < E - 1; ++j) G1.edges.emplace_back(keys[j] >> 8, keys[j] & 0xff);
+                image.emplace_back(std::move(G1), parity ? -1 : 1);
+            }
+            return image;
+        }
+
+    private:
+        static uint16_t edge_key(uint8_t a, uint8_t b) {
+            return a < b ? (a << 8 | b) : (b << 8 | a);
+        }
+
+        template <size_t M>
+        static int inversion_parity(const std::array<uint16_t, M>& keys, size_t len) {
+            int parity = 0;
+            for (size_t a = 0; a < len; ++a) {
+                for (size_t b = a + 1; b < len; ++b) parity ^= keys[a] > keys[b];
+            }
+            return parity;
+        }
+};
+
+// The hot graph kernels of one graph shape, either the FixedGraph instantiation or the generic
+// Graph methods. The fixed kernels fall back to the generic ones for graphs of another shape.
+struct GraphKernels {
+    size_t num_vertices;   // 0 for the generic kernels
+    size_t num_edges;
+    string (*to_g6)(const Graph&);
+    int (*perm_sign)(const Graph&, const ScratchPermutation&, bool);
+    vector<pair<Graph, int>> (*get_contractions_with_sign)(const Graph&, bool);
+};
+
+inline const GraphKernels& generic_graph_kernels() {
+    static const GraphKernels kernels{
+        0, 0,
+        [](const Graph& G) { return G.to_g6(); },
+        [](const Graph& G, const ScratchPermutation& p, bool even) { return G.perm_sign(p, even); },
+        [](const Graph& G, bool even) { return G.get_contractions_with_sign(even); }};
+    return kernels;
+}
+
+template <size_t N, size_t E>
+GraphKernels fixed_graph_kernels() {
+    using F = FixedGraph<N, E>;
+    return {
+        N, E,
+        [](const Graph& G) { return F::fits(G) ? F(G).to_g6() : G.to_g6(); },
+        [](const Graph& G, const ScratchPermutation& p, bool even) {
+            return F::fits(G) ? F(G).perm_sign(p, even) : G.perm_sign(p, even);
+        },
+        [](const Graph& G, bool even) {
+            return F::fits(G) ? F(G).get_contractions_with_sign(even) : G.get_contractions_with_sign(even);
+        }};
+}
+
+#endif // FIXEDGRAPH_HH
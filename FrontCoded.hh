@@ -0,0 +1,254 @@
+#ifndef FRONTCODED_HH
+#define FRONTCODED_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Front-coded list of strings, used as the compressed format of the .g6 basis files. Neighbouring
+// lines of a sorted basis share long prefixes, so every record but the first of a block stores
+// only the length of the prefix it shares with its predecessor and the remaining suffix.
+//
+// Layout (integers little-endian):
+//     0   "G6FC"        magic, distinguishes the format from text files
+//     4   u32           version (1)
+//     8   u32           records per block
+//     12  u32           reserved (0)
+//     16  u64           number of records
+//     24  u64           number of blocks
+//     32  u64           file offset of the block index
+//     40  u64           total length of the decoded records
+//     48  blocks; a block is
+//             varint length, bytes                            (first record)
+//             varint shared, varint suffix length, bytes      (every further record)
+//     index: per block u64 file offset, u64 offset of its first record in the decoded records
+// Decoding a block only needs the block itself, so the blocks decode in parallel and record i
+// is found with a single block decode.
+
+// Global switch, e.g. for --compress: Graph::save_to_file writes the front-coded format.
+inline bool g6_compress_setting = false;
+
+constexpr char front_coded_magic[4] = {'G', '6', 'F', 'C'};
+constexpr uint32_t front_coded_version = 1;
+constexpr size_t front_coded_header_size = 48;
+
+inline bool is_front_coded(const char* data, size_t length) {
+    return length >= front_coded_header_size && std::memcmp(data, front_coded_magic, 4) == 0;
+}
+
+inline bool is_front_coded_file(const string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[4];
+    return file.read(magic, 4) && std::memcmp(magic, front_coded_magic, 4) == 0;
+}
+
+inline void front_coded_put_u32(string& out, uint32_t x) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>(x >> (8 * i)));
+}
+
+inline void front_coded_put_u64(string& out, uint64_t x) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>(x >> (8 * i)));
+}
+
+inline void front_coded_put_varint(string& out, uint64_t x) {
+    while (x >= 0x80) {
+        out.push_back(static_cast<char>(x | 0x80));
+        x >>= 7;
+    }
+    out.push_back(static_cast<char>(x));
+}
+
+// Incremental encoder: add() the records in order, which passes their encoded bytes to a sink;
+// header() and get_index() are the parts of the file before and after them. So a list that does not
+// fit in memory can be written in two passes, the first one with a sink that drops the bytes.
+class FrontCodedEncoder {
+    public:
+        explicit FrontCodedEncoder(uint32_t block_records_ = 64) : block_records(block_records_) {}
+
+        template <typename Sink>
+        void add(string_view r, Sink&& sink) {
+            buf.clear();
+            if (num_records % block_records == 0) {
+                index.emplace_back(front_coded_header_size + body_bytes, decoded);
+                front_coded_put_varint(buf, r.size());
+                buf.append(r);
+            } else {
+                size_t shared = 0;
+                size_t max_shared = std::min(prev.size(), r.size());
+                while (shared < max_shared && prev[shared] == r[shared]) ++shared;
+                front_coded_put_varint(buf, shared);
+                front_coded_put_varint(buf, r.size() - shared);
+                buf.append(r.substr(shared));
+            }
+            prev.assign(r);
+            ++num_records;
+            body_bytes += buf.size();
+            decoded += r.size();
+            sink(string_view(buf));
+        }
+
+        string header() const {
+            string out;
+            out.append(front_coded_magic, 4);
+            front_coded_put_u32(out, front_coded_version);
+            front_coded_put_u32(out, block_records);
+            front_coded_put_u32(out, 0);
+            front_coded_put_u64(out, num_records);
+            front_coded_put_u64(out, index.size());
+            front_coded_put_u64(out, front_coded_header_size + body_bytes);
+            front_coded_put_u64(out, decoded);
+            return out;
+        }
+
+        string get_index() const {
+            string out;
+            out.reserve(16 * index.size());
+            for (const auto& [offset, first] : index) {
+                front_coded_put_u64(out, offset);
+                front_coded_put_u64(out, first);
+            }
+            return out;
+        }
+
+    private:
+        uint32_t block_records;
+        uint64_t num_records = 0;
+        uint64_t body_bytes = 0;
+        uint64_t decoded = 0;
+        vector<pair<uint64_t, uint64_t>> index;     // per block file offset, decoded offset
+        string prev;
+        string buf;
+};
+
+// The front-coded file contents of records.
+inline string encode_front_coded(const vector<string>& records, uint32_t block_records = 64) {
+    FrontCodedEncoder enc(block_records);
+    string body;
+    for (const auto& r : records) {
+        enc.add(r, [&](string_view bytes) { body.append(bytes); });
+    }
+    return enc.header() + body + enc.get_index();
+}
+
+// Non-owning view of a front-coded list, e.g. of a memory mapped file.
+class FrontCodedReader {
+    public:
+        FrontCodedReader(const char* data_, size_t length_) : data(data_), length(length_) {
+            if (!is_front_coded(data, length)) throw std::runtime_error("Not a front-coded file");
+            if (get_u32(4) != front_coded_version) throw std::runtime_error("Unsupported front-coded file version");
+            block_records = get_u32(8);
+            num_records = get_u64(16);
+            num_blocks = get_u64(24);
+            index_offset = get_u64(32);
+            decoded_length = get_u64(40);
+            if (block_records == 0 || (num_blocks == 0 && decoded_length != 0) || num_blocks != (num_records + block_records - 1) / block_records ||
+                index_offset < front_coded_header_size || index_offset > length ||
+                num_blocks != (length - index_offset) / 16 || index_offset + 16 * num_blocks != length) {
+                throw std::runtime_error("Corrupt front-coded file header");
+            }
+            // blocks in file order, each with at least one byte, and their records in order; a record
+            // is no longer than the encoded block, which bounds the decoded size of the block
+            for (size_t b = 0; b < num_blocks; ++b) {
+                size_t offset = get_u64(index_offset + 16 * b);
+                size_t first = get_u64(index_offset + 16 * b + 8);
+                size_t next_offset = b + 1 < num_blocks ? get_u64(index_offset + 16 * (b + 1)) : index_offset;
+                size_t next_first = decoded_offset(b + 1);
+                if ((b == 0 && (offset != front_coded_header_size || first != 0)) || offset >= next_offset ||
+                    next_offset > index_offset || first > next_first || next_first > decoded_length ||
+                    (next_first - first) / block_records > next_offset - offset) {
+                    throw std::runtime_error("Corrupt front-coded block index");
+                }
+            }
+        }
+
+        size_t size() const { return num_records; }
+        size_t get_num_blocks() const { return num_blocks; }
+        size_t get_block_records() const { return block_records; }
+        size_t get_decoded_length() const { return decoded_length; }
+
+        // Offset of the first record of block b in the decoded records.
+        size_t decoded_offset(size_t b) const {
+            return b < num_blocks ? get_u64(index_offset + 16 * b + 8) : decoded_length;
+        }
+
+        // Decode the records of block b, in order, into buf (which must have room for them, see
+        // decoded_offset) and pass each one to emit(string_view).
+        template <typename Emit>
+        void decode_block(size_t b, char* buf, Emit&& emit) const {
+            size_t pos = get_u64(index_offset + 16 * b);
+            size_t end = b + 1 < num_blocks ? get_u64(index_offset + 16 * (b + 1)) : index_offset;
+            size_t count = std::min<size_t>(block_records, num_records - b * block_records);
+            char* limit = buf + (decoded_offset(b + 1) - decoded_offset(b));
+            const char* prev = nullptr;
+            for (size_t k = 0; k < count; ++k) {
+                size_t shared = k == 0 ? 0 : get_varint(pos, end);
+                size_t suffix = get_varint(pos, end);
+                if (shared > 0 && (prev == nullptr || shared > static_cast<size_t>(buf - prev))) {
+                    throw std::runtime_error("Corrupt front-coded block");
+                }
+                if (suffix > end - pos || shared + suffix > static_cast<size_t>(limit - buf)) {
+                    throw std::runtime_error("Corrupt front-coded block");
+                }
+                if (shared > 0) std::memcpy(buf, prev, shared);
+                std::memcpy(buf + shared, data + pos, suffix);
+                pos += suffix;
+                emit(string_view(buf, shared + suffix));
+                prev = buf;
+                buf += shared + suffix;
+            }
+        }
+
+        // Record i, from a single block decode.
+        string record(size_t i) const {
+            if (i >= num_records) throw std::out_of_range("Record index out of range");
+            size_t b = i / block_records;
+            string buf(decoded_offset(b + 1) - decoded_offset(b), '\0');
+            string result;
+            size_t k = b * block_records;
+            decode_block(b, buf.data(), [&](string_view r) {
+                if (k++ == i) result.assign(r);
+            });
+            return result;
+        }
+
+    private:
+        const char* data;
+        size_t length;
+        size_t block_records;
+        size_t num_records;
+        size_t num_blocks;
+        size_t index_offset;
+        size_t decoded_length;
+
+        uint32_t get_u32(size_t pos) const {
+            uint32_t x = 0;
+            for (int i = 3; i >= 0; --i) x = x << 8 | static_cast<uint8_t>(data[pos + i]);
+            return x;
+        }
+
+        uint64_t get_u64(size_t pos) const {
+            uint64_t x = 0;
+            for (int i = 7; i >= 0; --i) x = x << 8 | static_cast<uint8_t>(data[pos + i]);
+            return x;
+        }
+
+        uint64_t get_varint(size_t& pos, size_t end) const {
+            uint64_t x = 0;
+            for (int shift = 0; pos < end && shift < 64; shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(data[pos++]);
+                x |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) return x;
+            }
+            throw std::runtime_error("Corrupt front-coded block");
+        }
+};
+
+#endif // FRONTCODED_HH
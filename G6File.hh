@@ -0,0 +1,197 @@
+#ifndef G6FILE_HH
+#define G6FILE_HH
+
+#include "FrontCoded.hh"
+#include "OutputFile.hh"
+#include "instrument.hh"
+#include "parallel.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Read-only memory mapped list of graph6 codes, one per line, optionally preceded by a line with
+// their number (the format of Graph::save_to_file). The records are string_views into the
+// mapping, valid as long as the G6File lives; empty lines are skipped. Large files are split at
+// line boundaries and the chunks are scanned in parallel. Front-coded files (see FrontCoded.hh)
+// are recognized by their magic bytes and decoded block-parallel into a buffer of their own.
+class G6File {
+    public:
+        explicit G6File(const string& filename, bool header = true) {
+            async_writer().wait(filename);
+            INSTR_SCOPE(IO);
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0) throw std::runtime_error("Failed to open file for reading");
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw std::runtime_error("Failed to open file for reading");
+            }
+            length = static_cast<size_t>(st.st_size);
+            if (length > 0) {
+                void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    ::close(fd);
+                    throw std::runtime_error("Failed to map file " + filename);
+                }
+                data = static_cast<const char*>(p);
+                ::madvise(p, length, MADV_SEQUENTIAL);
+            }
+            ::close(fd);
+
+            // the destructor does not run if the constructor throws
+            try {
+                if (is_front_coded(data, length)) {
+                    decode_front_coded();
+                    return;
+                }
+                const char* begin = data;
+                const char* end = data + length;
+                size_t num_graphs = 0;
+                if (header) {
+                    const char* eol = find_eol(begin, end);
+                    string first(begin, eol);
+                    try {
+                        size_t pos;
+                        num_graphs = std::stoul(first, &pos);
+                        if (pos != first.size()) throw std::invalid_argument(first);
+                    } catch (const std::exception&) {
+                        throw std::runtime_error("First line of " + filename + " is not the number of graphs");
+                    }
+                    begin = eol == end ? end : eol + 1;
+                }
+                split(begin, end);
+                if (header && records.size() != num_graphs) {
+                    throw std::runtime_error("Number of graphs in file does not match the first line");
+                }
+            } catch (...) {
+                unmap();
+                throw;
+            }
+        }
+
+        G6File(G6File&& other) noexcept
+            : data(std::exchange(other.data, nullptr)), length(std::exchange(other.length, 0)),
+              decoded(std::move(other.decoded)), records(std::move(other.records)) {}
+
+        G6File& operator=(G6File&& other) noexcept {
+            if (this != &other) {
+                unmap();
+                data = std::exchange(other.data, nullptr);
+                length = std::exchange(other.length, 0);
+                decoded = std::move(other.decoded);
+                records = std::move(other.records);
+            }
+            return *this;
+        }
+
+        G6File(const G6File&) = delete;
+        G6File& operator=(const G6File&) = delete;
+
+        ~G6File() {
+            unmap();
+        }
+
+        size_t size() const { return records.size(); }
+        bool empty() const { return records.empty(); }
+        string_view operator[](size_t i) const { return records[i]; }
+        vector<string_view>::const_iterator begin() const { return records.begin(); }
+        vector<string_view>::const_iterator end() const { return records.end(); }
+
+        // Owning copies of the records.
+        vector<string> strings() const {
+            vector<string> result(records.size());
+            parallel_for(records.size(), [&](size_t i, unsigned) {
+                result[i].assign(records[i]);
+            });
+            return result;
+        }
+
+    private:
+        // below this size a single thread scans the file
+        static constexpr size_t parallel_chunk_size = 1 << 20;
+
+        const char* data = nullptr;
+        size_t length = 0;
+        // the records of a front-coded file
+        std::unique_ptr<char[]> decoded;
+        vector<string_view> records;
+
+        static const char* find_eol(const char* p, const char* end) {
+            if (p == end) return end;
+            const void* nl = std::memchr(p, '\n', end - p);
+            return nl ? static_cast<const char*>(nl) : end;
+        }
+
+        static void scan(const char* p, const char* end, vector<string_view>& out) {
+            while (p < end) {
+                const char* eol = find_eol(p, end);
+                if (eol > p) out.emplace_back(p, eol - p);
+                p = eol + 1;
+            }
+        }
+
+        // Split [begin, end) into chunks starting after a newline, collect the records of every
+        // chunk in parallel, then concatenate them in file order.
+        void split(const char* begin, const char* end) {
+            size_t len = end - begin;
+            size_t num_chunks = std::min<size_t>(parallel_num_threads() * 4, std::max<size_t>(1, len / parallel_chunk_size));
+            vector<const char*> bounds(num_chunks + 1);
+            bounds[0] = begin;
+            bounds[num_chunks] = end;
+            for (size_t c = 1; c < num_chunks; ++c) {
+                const char* p = std::max(bounds[c - 1], begin + c * (len / num_chunks));
+                // a chunk starts at the beginning of a line
+                if (p > begin && p[-1] != '\n') {
+                    p = find_eol(p, end);
+                    if (p < end) ++p;
+                }
+                bounds[c] = p;
+            }
+            vector<vector<string_view>> parts(num_chunks);
+            parallel_for(num_chunks, [&](size_t c, unsigned) {
+                parts[c].reserve((bounds[c + 1] - bounds[c]) / 16);
+                scan(bounds[c], bounds[c + 1], parts[c]);
+            }, static_cast<unsigned>(num_chunks));
+            vector<size_t> offset(num_chunks + 1, 0);
+            for (size_t c = 0; c < num_chunks; ++c) offset[c + 1] = offset[c] + parts[c].size();
+            records.resize(offset[num_chunks]);
+            parallel_for(num_chunks, [&](size_t c, unsigned) {
+                std::copy(parts[c].begin(), parts[c].end(), records.begin() + offset[c]);
+                vector<string_view>().swap(parts[c]);
+            }, static_cast<unsigned>(num_chunks));
+        }
+
+        void decode_front_coded() {
+            FrontCodedReader reader(data, length);
+            decoded.reset(new char[std::max<size_t>(1, reader.get_decoded_length())]);
+            records.resize(reader.size());
+            parallel_for(reader.get_num_blocks(), [&](size_t b, unsigned) {
+                size_t k = b * reader.get_block_records();
+                reader.decode_block(b, decoded.get() + reader.decoded_offset(b),
+                                    [&](string_view r) { records[k++] = r; });
+            });
+            // the records do not point into the mapping
+            unmap();
+        }
+
+        void unmap() {
+            if (data) ::munmap(const_cast<char*>(data), length);
+            data = nullptr;
+            length = 0;
+        }
+};
+
+#endif // G6FILE_HH
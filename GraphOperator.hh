@@ -0,0 +1,251 @@
+#ifndef GRAPHOPERATOR_HH
+#define GRAPHOPERATOR_HH
+
+#include "mygraphs.hh"
+#include "GraphVectorSpace.hh"
+#include "Manifest.hh"
+#include "SparseMatrix.hh"
+#include "ModularRank.hh"
+#include "parallel.hh"
+#include "progress.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Base class of the linear graph operators D: domain -> target, with static dispatch to the
+// concrete operator Derived.
+//
+// Derived provides
+//     DomainSpace domain;                                     // GraphVectorSpace<...> subclasses
+//     TargetSpace target;
+//     string get_matrix_file_path() const;
+//     string to_string() const;                               // the parameters, for the manifest
+//     template <typename Emit> void operate_on(const Graph& G, Emit&& emit) const;
+// where operate_on calls emit(image, sign) for the terms of D(G). Images need not be canonical,
+// but must be simple graphs. Derived may override
+//     bool is_valid() const;
+//
+// The matrix has one row per domain basis element and one column per target basis element.
+// Images whose canonical form is not in the target basis contribute nothing.
+template <typename Derived>
+class GraphOperator {
+    public:
+        // Number of images whose canonical column and sign each thread remembers.
+        static constexpr size_t canon_cache_capacity = 1 << 16;
+
+        bool is_valid() const {
+            return derived().domain.is_valid() && derived().target.is_valid();
+        }
+
+        bool exists_matrix_file() const {
+            return output_complete(derived().get_matrix_file_path());
+        }
+
+        // Compute the matrix of the operator in the bases of domain and target, which must exist.
+        CsrMatrix compute_matrix() const {
+            const Derived& d = derived();
+            G6File in_basis = d.domain.get_basis_file();
+            G6File out_basis = d.target.get_basis_file();
+            unordered_map<string_view, size_t> out_index;
+            out_index.reserve(out_basis.size());
+            for (size_t i = 0; i < out_basis.size(); ++i) {
+                out_index.emplace(out_basis[i], i);
+            }
+            const vector<unsigned> colors = d.target.get_vertex_colors();
+
+            // per-thread cache: image g6 -> (column or -1, sign of its canonical relabeling)
+            vector<unordered_map<string, pair<long, int>>> caches(parallel_num_threads());
+            vector<vector<pair<size_t, int>>> rows(in_basis.size());
+            ProgressReporter progress("matrix rows", in_basis.size());
+            parallel_for(in_basis.size(), [&](size_t row, unsigned tid) {
+                auto& cache = caches[tid];
+                auto& acc = rows[row];
+                Graph g = Graph::from_g6(in_basis[row]);
+                d.operate_on(g, [&](const Graph& image, int sign) {
+                    ArenaScope scope;
+                    string key = d.target.to_g6(image);
+                    auto it = cache.find(key);
+                    if (it == cache.end()) {
+                        CanonicalForm cf = d.target.canonical_form(image, colors);
+                        // matched on the code alone: a basis may contain graphs that have odd
+                        // automorphisms as simple graphs (e.g. from multigraph generators)
+                        auto jt = out_index.find(cf.g6);
+                        long col = jt != out_index.end() ? static_cast<long>(jt->second) : -1;
+                        if (cache.size() >= canon_cache_capacity) cache.clear();
+                        it = cache.emplace(std::move(key), make_pair(col, cf.sign)).first;
+                    }
+                    if (it->second.first < 0) return;
+                    INSTR_COUNT(MatrixEntries, 1);
+                    acc.emplace_back(it->second.first, sign * it->second.second);
+                });
+                // sparse accumulator: combine the entries of the row by column
+                {
+                    INSTR_SCOPE(MatrixAssembly);
+                    std::sort(acc.begin(), acc.end());
+                    size_t out = 0;
+                    for (size_t i = 0; i < acc.size();) {
+                        size_t col = acc[i].first;
+                        int sum = 0;
+                        for (; i < acc.size() && acc[i].first == col; ++i) sum += acc[i].second;
+                        if (sum != 0) acc[out++] = {col, sum};
+                    }
+                    acc.resize(out);
+                    acc.shrink_to_fit();
+                }
+                progress.inc();
+            });
+            progress.finish();
+
+            INSTR_SCOPE(MatrixAssembly);
+            CsrMatrix m(in_basis.size(), out_basis.size());
+            for (size_t r = 0; r < rows.size(); ++r) {
+                m.row_ptr[r + 1] = m.row_ptr[r] + rows[r].size();
+            }
+            m.col_idx.reserve(m.row_ptr.back());
+            m.vals.reserve(m.row_ptr.back());
+            for (auto& row : rows) {
+                for (const auto& [col, val] : row) {
+                    m.col_idx.push_back(col);
+                    m.vals.push_back(val);
+                }
+                vector<pair<size_t, int>>().swap(row);
+            }
+            return m;
+        }
+
+        // The basis files the matrix is computed from.
+        vector<string> get_matrix_inputs() const {
+            return {derived().domain.get_basis_file_path(), derived().target.get_basis_file_path()};
+        }
+
+        // Whether the matrix file is up to date with the bases, see output_up_to_date.
+        bool matrix_up_to_date() const {
+            return output_up_to_date(derived().get_matrix_file_path(), derived().to_string(), get_matrix_inputs());
+        }
+
+        // Build the matrix file. Skipped if the operator is not valid, or if the file is up to date
+        // and ignore_existing_files is false. With num_rank_primes > 0 also compute the rank of the
+        // matrix modulo that many primes (see build_rank), on the matrix in memory.
+        void build_matrix(bool ignore_existing_files = false, size_t num_rank_primes = 0) const {
+            if (!derived().is_valid()) {
+                return;
+            }
+            string fname = derived().get_matrix_file_path();
+            if (!ignore_existing_files && matrix_up_to_date()) {
+                if (num_rank_primes > 0 && !rank_up_to_date(num_rank_primes)) build_rank(load_matrix(), num_rank_primes);
+                return;
+            }
+            cout << "Building matrix for " << derived().to_string() << endl;
+            ensure_folder_of_filename_exists(fname);
+            auto sums = input_checksums(get_matrix_inputs());
+            auto m = std::make_shared<const CsrMatrix>(compute_matrix());
+            // written in the background, while the rank or the next matrix is computed
+            string params = derived().to_string();
+            string shape = std::to_string(m->nrows) + " x " + std::to_string(m->ncols);
+            async_writer().submit(fname, [m](OutputFile& out) { return m->write_sms(out); },
+                                  [fname, params, sums, shape](const OutputSummary& s) {
+                                      record_output(fname, "matrix", params, sums, s, shape);
+                                  });
+            cout << "Writing matrix to " << fname << endl;
+            if (num_rank_primes > 0) build_rank(*m, num_rank_primes);
+        }
+
+        // <matrix file>_rank.txt: the rank, followed by one line "prime rank-modulo-prime" per prime.
+        string get_rank_file_path() const {
+            string fname = derived().get_matrix_file_path();
+            size_t pos = fname.rfind(".txt");
+            return fname.substr(0, pos) + "_rank.txt";
+        }
+
+        bool exists_rank_file() const {
+            return output_complete(get_rank_file_path());
+        }
+
+        string get_rank_params(size_t num_primes) const {
+            return derived().to_string() + " rank mod " + std::to_string(num_primes) + " primes";
+        }
+
+        // Whether the rank file is up to date with the matrix file, see output_up_to_date.
+        bool rank_up_to_date(size_t num_primes) const {
+            return output_up_to_date(get_rank_file_path(), get_rank_params(num_primes), {derived().get_matrix_file_path()});
+        }
+
+        // Compute the rank of m modulo num_primes primes, report it and store it in the rank file.
+        RankResult build_rank(const CsrMatrix& m, size_t num_primes) const {
+            RankResult res = multi_prime_rank(m, num_primes);
+            cout << "Rank of " << derived().to_string() << " (" << m.nrows << " x " << m.ncols
+                 << ", " << m.nnz() << " entries): " << res.rank << endl;
+            for (const auto& [p, r] : res.per_prime) {
+                if (r != res.rank) cout << "  rank mod " << p << " is only " << r << endl;
+            }
+            OutputFile out(get_rank_file_path());
+            out.write_uint(res.rank);
+            out.write('\n');
+            for (const auto& [p, r] : res.per_prime) {
+                out.write_uint(p);
+                out.write(' ');
+                out.write_uint(r);
+                out.write('\n');
+            }
+            // waits for a background write of the matrix
+            auto sums = input_checksums({derived().get_matrix_file_path()});
+            record_output(get_rank_file_path(), "rank", get_rank_params(num_primes), sums,
+                          out.commit(1 + res.per_prime.size()));
+            return res;
+        }
+
+        // The stored rank, -1 if there is no rank file.
+        long load_rank() const {
+            long rank = -1;
+            if (!exists_rank_file()) return rank;
+            ifstream file(get_rank_file_path());
+            file >> rank;
+            return rank;
+        }
+
+        CsrMatrix load_matrix() const {
+            return CsrMatrix::load_sms(derived().get_matrix_file_path());
+        }
+
+    private:
+        const Derived& derived() const { return static_cast<const Derived&>(*this); }
+};
+
+// Check that the composition D2 o D1 of two operators vanishes, D1.target being D2.domain.
+// Both matrix files must exist. The product of the matrices is computed modulo p; every nonzero
+// entry is a pair (domain basis element of D1, target basis element of D2) whose coefficient in
+// D2(D1(G)) does not cancel. The first max_report of them are printed with their g6 codes.
+// Returns the number of nonzero entries.
+template <typename Op1, typename Op2>
+size_t check_composition(const Op1& d1, const Op2& d2, uint32_t p = rank_primes()[0], size_t max_report = 20) {
+    CsrMatrix a = d1.load_matrix();
+    CsrMatrix b = d2.load_matrix();
+    if (a.ncols != b.nrows) {
+        throw std::runtime_error("Matrices of " + d1.to_string() + " and " + d2.to_string() + " are not composable");
+    }
+    CsrMatrix prod = csr_product_mod(a, b, p);
+    size_t nnz = prod.nnz();
+    cout << d2.to_string() << " o " << d1.to_string() << ": " << (nnz == 0 ? "zero" : "NONZERO")
+         << " (" << a.nrows << " x " << a.ncols << " x " << b.ncols << ", " << nnz << " nonzero entries)" << endl;
+    if (nnz == 0) {
+        return 0;
+    }
+    G6File in_basis = d1.domain.get_basis_file();
+    G6File out_basis = d2.target.get_basis_file();
+    size_t reported = 0;
+    for (size_t r = 0; r < prod.nrows && reported < max_report; ++r) {
+        for (size_t i = prod.row_ptr[r]; i < prod.row_ptr[r + 1] && reported < max_report; ++i, ++reported) {
+            cout << "  " << in_basis[r] << " -> " << out_basis[prod.col_idx[i]] << ": " << prod.vals[i] << endl;
+        }
+    }
+    return nnz;
+}
+
+#endif // GRAPHOPERATOR_HH
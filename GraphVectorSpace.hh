@@ -1,138 +1,185 @@
 #ifndef GRAPHVECTORSPACE_HH
 #define GRAPHVECTORSPACE_HH
 
-#include <vector>
-#include <string>
 #include "mygraphs.hh"
+#include "Manifest.hh"
+#include "parallel.hh"
+#include "progress.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 using namespace std;
 
-class GraphVectorSpace {
+// Parallel streaming build engine shared by all graph vector spaces.
+// generate(i, emit) is called once for every work item i in [0, n) and passes its candidate
+// graphs to emit. Each candidate is canonicalized with canon(G), which returns a CanonicalForm,
+// and inserted into found, in the set of the calling thread; if filter_odd is set, candidates with
+// an odd automorphism are dropped. found.finish() then gives the sorted distinct canonical codes.
+template <typename Generate, typename Canon>
+void collect_canonical_g6(size_t n, const string& label, Generate&& generate, Canon&& canon, bool filter_odd,
+                          G6DedupSet& found) {
+    ProgressReporter progress(label, n);
+    parallel_for(n, [&](size_t i, unsigned tid) {
+        generate(i, [&](const Graph& G) {
+            ArenaScope scope;
+            CanonicalForm cf = canon(G);
+            if (filter_odd && cf.odd_automorphism) return;
+            INSTR_SCOPE(DedupInsert);
+            INSTR_COUNT(DedupInserts, 1);
+            found.insert(tid, std::move(cf.g6));
+        });
+        progress.inc();
+    });
+    progress.finish();
+}
 
+// Base class of the graph vector spaces, with static dispatch to the concrete space Derived.
+//
+// Derived provides
+//     bool even_edges;
+//     bool is_valid() const;
+//     string to_string() const;                                // the parameters, for the manifest
+//     string get_basis_file_path() const;
+//     size_t get_num_generators() const;                       // number of work items
+//     template <typename Emit> void generate(size_t i, Emit&& emit) const;
+// and may override
+//     vector<string> get_basis_inputs() const;                 // files the basis is computed from
+//     void prepare_inputs(bool ignore_existing_files);         // brings them up to date
+//     void prepare_generators();                               // called once before generating
+//     int perm_sign(const Graph& G, const ScratchPermutation& p) const;
+//     vector<vector<uint8_t>> get_partition() const;          // vertex partition, e.g. hairs
+//     string to_g6(const Graph& G) const;                      // e.g. a FixedGraph kernel
+//
+// Spaces with a nontrivial partition are canonicalized as vertex-colored graphs; automorphisms
+// then preserve the blocks, and the sign rule only sees color preserving permutations.
+// The basis consists of the canonical forms of the generated graphs without odd automorphisms.
+template <typename Derived>
+class GraphVectorSpace {
     public:
-        virtual string get_basis_file_path();
-        virtual bool is_valid();
-
         // Build the basis of the vector space.
-        // If the vector space is not valid, or the basis file exists and ignore_existing_files is false, skip.
+        // If the vector space is not valid, or the basis file is up to date (see output_up_to_date)
+        // and ignore_existing_files is false, skip.
         void build_basis(bool ignore_existing_files = false) {
-            if (!is_valid()) {
+            if (!derived().is_valid()) {
                 return;
             }
-            if (!ignore_existing_files && exists_basis_file()) {
+            string fname = derived().get_basis_file_path();
+            cout << "Building basis for " << fname << endl;
+            // the inputs must be current before their checksums are compared
+            derived().prepare_inputs(ignore_existing_files);
+            vector<string> inputs = derived().get_basis_inputs();
+            if (!ignore_existing_files && basis_up_to_date(inputs)) {
                 return;
             }
+            derived().prepare_generators();
+            ensure_folder_of_filename_exists(fname);
+            const Derived& d = derived();
+            const vector<unsigned> colors = get_vertex_colors();
+            // under a memory budget, spilled next to the basis file
+            G6DedupSet found(fname);
+            collect_canonical_g6(
+                d.get_num_generators(), "basis",
+                [&](size_t i, auto&& emit) { d.generate(i, emit); },
+                [&](const Graph& G) { return d.canonical_form(G, colors); },
+                true, found);
+            store_basis_g6(found.finish(), inputs);
+        }
 
-            string desc = "Build basis: " + get_ordered_param_dict();
-            auto generating_list = get_generating_graphs();
-            cout << desc << endl;
-            set<string> basis_set;
-
-            for (auto& G : generating_list) {
-                vector<Automorphism> autom_list;
-                Graph canonG;
-                if (get_partition().empty()) {
-                    autom_list = G.automorphism_group().gens();
-                    canonG = G.canonical_label(Parameters::canonical_label_algorithm);
-                } else {
-                    autom_list = G.automorphism_group(get_partition()).gens();
-                    canonG = G.canonical_label(get_partition(), Parameters::canonical_label_algorithm);
-                }
-                string canon6 = canonG.graph6_string();
-                if (basis_set.find(canon6) == basis_set.end()) {
-                    if (!_has_odd_automorphisms(G, autom_list)) {
-                        basis_set.insert(canon6);
-                    }
-                }
-            }
-            vector<string> L(basis_set.begin(), basis_set.end());
-            sort(L.begin(), L.end());
-            _store_basis_g6(L);
+        // Canonical form of G together with its sign and whether G has an odd automorphism
+        // under the sign rule of the space, from a single bliss search.
+        CanonicalForm canonical_form(const Graph& G, const vector<unsigned>& colors) const {
+            return G.canonical_form_with([&](const ScratchPermutation& p) { return derived().perm_sign(G, p); }, colors,
+                                         [&](const Graph& g) { return derived().to_g6(g); });
         }
 
-    protected:
-        // Return whether the graph G has odd automorphisms.
-        bool _has_odd_automorphisms(const Graph& G, const vector<Automorphism>& autom_list) {
-            for (const auto& p : autom_list) {
-                auto pd = p.dict();
-                vector<int> pp(G.order());
-                for (int j = 0; j < G.order(); ++j) {
-                    pp[j] = pd[j];
-                }
-                if (perm_sign(G, pp) == -1) {
-                    return true;
-                }
-            }
-            return false;
+        CanonicalForm canonical_form(const Graph& G) const {
+            return canonical_form(G, get_vertex_colors());
         }
 
-        // Return whether there exists a basis file.
-        bool exists_basis_file() {
-            ifstream f(get_basis_file_path());
-            return f.good();
+        // Default: a single block, i.e., uncolored graphs.
+        vector<vector<uint8_t>> get_partition() const {
+            return {};
         }
 
-        // Return the dimension of the vector space.
-        int get_dimension() {
-            if (!is_valid()) {
-                return 0;
-            }
-            try {
-                string header = StoreLoad::load_line(get_basis_file_path());
-                return stoi(header);
-            } catch (const StoreLoad::FileNotFoundError&) {
-                throw StoreLoad::FileNotFoundError("Dimension unknown: No basis file");
-            }
+        vector<unsigned> get_vertex_colors() const {
+            return partition_to_colors(derived().get_partition());
         }
 
-        // Store the basis to the basis file.
-        void _store_basis_g6(vector<string> basis_list) {
-            basis_list.insert(basis_list.begin(), to_string(basis_list.size()));
-            StoreLoad::store_string_list(basis_list, get_basis_file_path());
+        // Default sign rule: orientation of the edges for even edges, order of the edges for odd.
+        int perm_sign(const Graph& G, const ScratchPermutation& p) const {
+            return G.perm_sign(p, derived().even_edges);
         }
 
-        // Load the basis from the basis file.
-        vector<string> _load_basis_g6() {
-            if (!exists_basis_file()) {
-                throw StoreLoad::FileNotFoundError("Cannot load basis, No basis file found");
-            }
-            vector<string> basis_list = StoreLoad::load_string_list(get_basis_file_path());
-            int dim = stoi(basis_list.front());
-            basis_list.erase(basis_list.begin());
-            if (basis_list.size() != dim) {
-                throw std::runtime_error("Basis read from file has wrong dimension");
-            }
-            return basis_list;
+        vector<string> get_basis_inputs() const {
+            return {};
+        }
+
+        void prepare_inputs(bool) {}
+
+        void prepare_generators() {}
+
+        string to_g6(const Graph& G) const {
+            return G.to_g6();
+        }
+
+        // Whether the basis file was written completely, see OutputFile.
+        bool exists_basis_file() const {
+            return output_complete(derived().get_basis_file_path());
+        }
+
+        // Whether the basis file can be reused, see output_up_to_date.
+        bool basis_up_to_date(const vector<string>& inputs) const {
+            return output_up_to_date(derived().get_basis_file_path(), derived().to_string(), inputs);
         }
 
         // Return the basis of the vector space as list of graph6 strings.
-        vector<string> get_basis_g6() {
-            if (!is_valid()) {
-                // Return empty list if graph vector space is not valid.
-                cerr << "Empty basis: not valid" << endl;
-                return {};
-            }
-            return _load_basis_g6();
+        vector<string> get_basis_g6() const {
+            return Graph::load_from_file(derived().get_basis_file_path());
         }
 
-        // Return the basis of the vector space as list of Graph objects.
-        vector<Graph> get_basis() {
-            vector<Graph> result;
-            for (const auto& g6 : get_basis_g6()) {
-                result.push_back(Graph(g6));
-            }
-            return result;
+        // The basis file mapped into memory, without copying the codes.
+        G6File get_basis_file() const {
+            return G6File(derived().get_basis_file_path());
         }
 
-        // The following methods must be implemented in derived classes:
-        virtual vector<Graph> get_generating_graphs() = 0;
-        virtual string get_ordered_param_dict() = 0;
-        virtual vector<vector<int>> get_partition() = 0;
-        virtual int perm_sign(const Graph& G, const vector<int>& perm) = 0;
+        // Return the basis of the vector space as list of Graph objects.
+        vector<Graph> get_basis() const {
+            return Graph::load_graphs_from_file(derived().get_basis_file_path());
+        }
 
-}
+        size_t get_dimension() const {
+            return derived().is_valid() ? get_basis_file().size() : 0;
+        }
 
+        map<string, size_t> get_basis_dict() const {
+            vector<string> g6s = get_basis_g6();
+            map<string, size_t> g6s_map;
+            for (size_t i = 0; i < g6s.size(); ++i) {
+                g6s_map[g6s[i]] = i;
+            }
+            return g6s_map;
+        }
 
+    protected:
+        // Store the (sorted) basis to the basis file, in the background, and record it in the
+        // manifest together with the current checksums of the inputs.
+        void store_basis_g6(SortedG6List g6s, const vector<string>& inputs = {}) const {
+            string fname = derived().get_basis_file_path();
+            string params = derived().to_string();
+            auto sums = input_checksums(inputs);
+            Graph::save_to_file_async(std::move(g6s), fname, [fname, params, sums](const OutputSummary& s) {
+                record_output(fname, "basis", params, sums, s);
+            });
+        }
 
+    private:
+        Derived& derived() { return static_cast<Derived&>(*this); }
+        const Derived& derived() const { return static_cast<const Derived&>(*this); }
+};
 
-#endif
\ No newline at end of file
+#endif // GRAPHVECTORSPACE_HH
@@ -2,6 +2,12 @@
 #define KNEISSLER_HH
 
 #include "mygraphs.hh"
+#include "GraphVectorSpace.hh"
+#include "GraphOperator.hh"
+#include "FixedGraph.hh"
+#include "progress.hh"
+#include "parallel.hh"
+#include "SparseMatrix.hh"
 
 
 #include <vector>
@@ -14,10 +20,15 @@
 #include <stdexcept>
 #include <map>
 #include <filesystem>
+#include <cstdio>
+#include <iterator>
+#include <utility>
 
 using namespace std;
 
 Graph barrel_graph(uint8_t k, const vector<uint8_t>& p) {
+    INSTR_SCOPE(GraphConstruction);
+    INSTR_COUNT(Candidates, 1);
     Graph g(2 * k);
     // generate rims of barrel
     for (uint8_t j = 0; j < k; ++j) {
@@ -44,6 +55,30 @@ vector<vector<uint8_t>> all_permutations(uint8_t n) {
     return perms;
 }
 
+size_t factorial(uint8_t n) {
+    size_t f = 1;
+    for (uint8_t i = 2; i <= n; ++i) f *= i;
+    return f;
+}
+
+// The permutation of {0,...,n-1} at position rank in lexicographic order, i.e., the
+// permutation all_permutations(n)[rank], without enumerating the ones before it.
+vector<uint8_t> nth_permutation(uint8_t n, size_t rank) {
+    vector<uint8_t> avail(n);
+    for (uint8_t i = 0; i < n; ++i) avail[i] = i;
+    vector<uint8_t> p;
+    p.reserve(n);
+    size_t f = factorial(n);
+    for (uint8_t i = n; i > 0; --i) {
+        f /= i;
+        size_t idx = rank / f;
+        rank %= f;
+        p.push_back(avail[idx]);
+        avail.erase(avail.begin() + idx);
+    }
+    return p;
+}
+
 vector<Graph> all_barrel_graphs(uint8_t k) {
     vector<Graph> result;
     auto perms = all_permutations(k - 1);
@@ -54,6 +89,8 @@ vector<Graph> all_barrel_graphs(uint8_t k) {
 }
 
 Graph tbarrel_graph(uint8_t k, const vector<uint8_t>& p) {
+    INSTR_SCOPE(GraphConstruction);
+    INSTR_COUNT(Candidates, 1);
     Graph g(2 * k - 1);
     // one rim of length k
     for (uint8_t j = 0; j < k; ++j) {
@@ -98,6 +135,8 @@ vector<Graph> all_tbarrel_graphs(uint8_t k) {
 }
 
 Graph xtbarrel_graph(uint8_t k, const vector<uint8_t>& p) {
+    INSTR_SCOPE(GraphConstruction);
+    INSTR_COUNT(Candidates, 1);
     Graph g(2 * k - 1);
     for (uint8_t j = 0; j < k - 1; ++j) {
         g.add_edge(j, (j + 1) % (k - 1));
@@ -142,6 +181,8 @@ vector<Graph> all_xtbarrel_graphs(uint8_t k) {
 }
 
 Graph triangle_graph(uint8_t k, const vector<uint8_t>& p) {
+    INSTR_SCOPE(GraphConstruction);
+    INSTR_COUNT(Candidates, 1);
     Graph g(2 * k);
     for (uint8_t j = 0; j < k; ++j) {
         g.add_edge(j, (j + 1) % k);
@@ -172,6 +213,8 @@ vector<Graph> all_triangle_graphs(uint8_t k) {
 }
 
 Graph hgraph(uint8_t k, const vector<uint8_t>& p) {
+    INSTR_SCOPE(GraphConstruction);
+    INSTR_COUNT(Candidates, 1);
     Graph g(2 * k);
     for (uint8_t j = 0; j < k - 1; ++j) {
         g.add_edge(j, (j + 1) % (k - 1));
@@ -202,34 +245,26 @@ vector<Graph> all_hgraph_graphs(uint8_t k) {
     return result;
 }
 
-void ensure_folder_of_filename_exists(const string& filename) {
-    size_t pos = filename.find_last_of("/\\");
-    if (pos != string::npos) {
-        string folder = filename.substr(0, pos);
-        if (!std::filesystem::exists(folder)) {
-            std::filesystem::create_directories(folder);
-        }
-    }
-}
     
 
 void save_matrix_to_sms_file(const map<pair<size_t, size_t>, int>& matrix, int nrows, int ncols, const string& filename) {
+    INSTR_SCOPE(IO);
     ensure_folder_of_filename_exists(filename);
-    ofstream file(filename);
-    if (!file) throw std::runtime_error("Failed to open file for writing");
+    OutputFile out(filename);
     // first line is rows cols M
-    file << nrows << " " << ncols << " " << matrix.size() << "\n";
+    out.write(std::to_string(nrows) + " " + std::to_string(ncols) + " " + std::to_string(matrix.size()) + "\n");
     for (const auto& [key, value] : matrix) {
         // sms file uses 1-based indexing
-        file << key.first+1 << " " << key.second+1 << " " << value << "\n";
+        out.write(std::to_string(key.first + 1) + " " + std::to_string(key.second + 1) + " " + std::to_string(value) + "\n");
     }
     // last line is 0 0 0
-    file << "0 0 0\n";
-    // close file
-    file.close();
+    out.write("0 0 0\n");
+    out.commit(matrix.size());
 }
 
 map<pair<size_t, size_t>, int> load_matrix_from_sms_file(const string& filename, int& nrows, int& ncols) {
+    INSTR_SCOPE(IO);
+    async_writer().wait(filename);
     ifstream file(filename);
     if (!file) throw std::runtime_error("Failed to open file for reading");
     map<pair<size_t, size_t>, int> matrix;
@@ -248,11 +283,32 @@ map<pair<size_t, size_t>, int> load_matrix_from_sms_file(const string& filename,
     return matrix;
 }
 
-string get_type_string(bool even_edges) {
-    return even_edges ? "even_edges" : "odd_edges";
+// Kernels specialized for the Kneissler graphs of loop order 3 to 16: with k = loops - 1 the
+// types 0, 2 and 3 have 2k vertices and 3k edges, type 1 has 2k - 1 vertices and 3k - 1 edges.
+constexpr uint8_t kneissler_fixed_min_loops = 3;
+constexpr uint8_t kneissler_fixed_max_loops = 16;
+
+template <size_t... I>
+vector<GraphKernels> make_kneissler_kernels(std::index_sequence<I...>) {
+    vector<GraphKernels> kernels;
+    ((kernels.push_back(fixed_graph_kernels<2 * (I + kneissler_fixed_min_loops - 1), 3 * (I + kneissler_fixed_min_loops - 1)>()),
+      kernels.push_back(fixed_graph_kernels<2 * (I + kneissler_fixed_min_loops - 1) - 1, 3 * (I + kneissler_fixed_min_loops - 1) - 1>())),
+     ...);
+    return kernels;
+}
+
+// Kernels for the Kneissler graphs of the given loop order (of type 1 if contracted); the generic
+// ones outside of the specialized range.
+inline const GraphKernels& kneissler_kernels(uint8_t loops, bool contracted) {
+    static const vector<GraphKernels> table = make_kneissler_kernels(
+        std::make_index_sequence<kneissler_fixed_max_loops - kneissler_fixed_min_loops + 1>());
+    if (loops < kneissler_fixed_min_loops || loops > kneissler_fixed_max_loops) {
+        return generic_graph_kernels();
+    }
+    return table[2 * (loops - kneissler_fixed_min_loops) + (contracted ? 1 : 0)];
 }
 
-class KneisslerGVS  {
+class KneisslerGVS : public GraphVectorSpace<KneisslerGVS> {
     public:
         uint8_t num_loops;
         uint8_t kn_type; // 0=trivalent generators, 1=relation generators, 2=all trivalent, 3=trivalent complement
@@ -260,6 +316,10 @@ class KneisslerGVS  {
         uint8_t num_vertices;
         size_t num_edges;
         uint8_t k;
+        const GraphKernels* kernels;
+
+        // Use the kernels specialized on the vertex and edge count where available.
+        static inline bool fixed_kernels = true;
 
         KneisslerGVS(uint8_t loops, uint8_t kntype_, bool even_edges_)
             : num_loops(loops), kn_type(kntype_), even_edges(even_edges_) {
@@ -270,130 +330,91 @@ class KneisslerGVS  {
                     num_edges -= 1;
                     num_vertices -= 1;
                 }
+                kernels = fixed_kernels ? &kneissler_kernels(num_loops, kn_type == 1) : &generic_graph_kernels();
             }
 
-        string get_basis_file_path(){
+        bool is_valid() const {
+            return num_loops >= 3;
+        }
+
+        string get_basis_file_path() const {
             return "data/kneissler/" + get_type_string(even_edges) +
                    "/gra" + std::to_string(num_loops) +
                    "_" + std::to_string(kn_type) + ".g6";
         }
 
-        string get_ref_basis_file_path() {
+        string get_ref_basis_file_path() const {
             return "data/kneissler/ref/" + get_type_string(even_edges) +
                         "/gra" + std::to_string(num_loops) +
                         "_" + std::to_string(kn_type) + ".g6";
         }
 
-        vector<string> get_basis_g6() {
-            // if (!is_valid()) {
-            //     // Return empty list if graph vector space is not valid.
-            //     cerr << "Empty basis: not valid" << endl;
-            //     return {};
-            // }
-            return Graph::load_from_file(get_basis_file_path());
+        // One work item per permutation of the spokes.
+        size_t get_num_generators() const {
+            return factorial(k - 1);
         }
 
-        void build_basis(bool ignore_existing_files = false) {
-            string fname = get_basis_file_path();
-            cout << "Building basis for " << fname << endl;
-            // exit if file exists and ignore_existing_files is false
-            if (!ignore_existing_files && std::ifstream(fname)) {
-                return;
-            }
-            ensure_folder_of_filename_exists(fname);
-            auto perms = all_permutations(k - 1);
-            std::set<std::string> g6s;
-
+        template <typename Emit>
+        void generate(size_t rank, Emit&& emit) const {
+            vector<uint8_t> p = nth_permutation(k - 1, rank);
             if (kn_type == 0) {
-                for (const auto& p : perms) {
-                    Graph g = barrel_graph(k, p);
-                    if (!g.has_odd_automorphism(even_edges)) {
-                        g6s.insert(g.to_canon_g6());
-                    }
-                }
+                emit(barrel_graph(k, p));
             } else if (kn_type == 1) {
-                for (const auto& p : perms) {
-                    Graph g = tbarrel_graph(k, p);
-                    if (!g.has_odd_automorphism(even_edges)) {
-                        string g6 = g.to_canon_g6();
-                        // Graph::check_g6_valid(g6, 1, "can_tbarrel_graph");
-                        g6s.insert(g6);
-                    }
-                    if (p[k - 2] != k-2) {
-                        Graph gg = xtbarrel_graph(k, p);
-                        if (!gg.has_odd_automorphism(even_edges)) {
-                            // gg.check_valid(1, "can_xtbarrel_graph0 ");
-                            // cout << "gg " << gg.to_g6() << endl;
-                            string g6 = gg.to_canon_g6();
-                            // if (!Graph::check_g6_valid(g6, 1, "can_xtbarrel_graph ")) {
-                            //     cout << "gg " << gg.num_vertices  << endl;
-                            //     // print edge list 
-                            //     // for (const auto& e : gg.edges) {
-                            //     //     cout << (int)e.u << " " << (int)e.v << " " << (int)e.data << endl;
-                            //     // }
-                            //     cout << "g6 " << g6 << endl;
-                            //     std::exit(-1);
-                            // }
-                            g6s.insert(g6);
-                        }
-                    }
+                emit(tbarrel_graph(k, p));
+                if (p[k - 2] != k - 2) {
+                    emit(xtbarrel_graph(k, p));
                 }
             } else if (kn_type == 2) {
-                for (const auto& p : perms) {
-                    Graph g = barrel_graph(k, p);
-                    if (!g.has_odd_automorphism(even_edges)) {
-                        g6s.insert(g.to_canon_g6());
-                    }
-                    Graph gg = triangle_graph(k, p);
-                    if (!gg.has_odd_automorphism(even_edges)) {
-                        g6s.insert(gg.to_canon_g6());
-                    }
-                    if (p[k - 2] > 0) {
-                        Graph ggg = hgraph(k, p);
-                        if (!ggg.has_odd_automorphism(even_edges)) {
-                            g6s.insert(ggg.to_canon_g6());
-                        }
-                    }
+                emit(barrel_graph(k, p));
+                emit(triangle_graph(k, p));
+                if (p[k - 2] > 0) {
+                    emit(hgraph(k, p));
                 }
-            } else if (kn_type == 3) {
-                // we assume the type 0 and 2 basis files exist
-                KneisslerGVS gvs0(num_loops, 0, even_edges);
-                KneisslerGVS gvs2(num_loops, 2, even_edges);
-
-                string fname0 = gvs0.get_basis_file_path();
-                string fname2 = gvs2.get_basis_file_path();
-
-                vector<string> gs0_ = Graph::load_from_file(fname0);
-                vector<string> gs2_ = Graph::load_from_file(fname2);
-                for (const auto& g : gs2_) {
-                    if (std::find(gs0_.begin(), gs0_.end(), g) == gs0_.end()) {
-                        g6s.insert(g);
-                    }
-                }
-            } else {
+            }
+        }
+
+        void build_basis(bool ignore_existing_files = false) {
+            if (kn_type > 3) {
                 throw std::runtime_error("Unknown graph type");
             }
-            vector<string> gs2(g6s.begin(), g6s.end());
-            std::sort(gs2.begin(), gs2.end());
-            Graph::save_to_file(gs2, fname);
+            if (kn_type != 3) {
+                GraphVectorSpace::build_basis(ignore_existing_files);
+                return;
+            }
+            // type 3 is the complement of type 0 in type 2, not generated
+            string fname = get_basis_file_path();
+            cout << "Building basis for " << fname << endl;
+            // we assume the type 0 and 2 basis files exist
+            KneisslerGVS V0(num_loops, 0, even_edges);
+            KneisslerGVS V2(num_loops, 2, even_edges);
+            vector<string> inputs = {V0.get_basis_file_path(), V2.get_basis_file_path()};
+            if (!ignore_existing_files && basis_up_to_date(inputs)) {
+                return;
+            }
+            ensure_folder_of_filename_exists(fname);
+            G6File gs0 = V0.get_basis_file();
+            G6File gs2 = V2.get_basis_file();
+            // both lists are sorted
+            vector<string_view> diff;
+            std::set_difference(gs2.begin(), gs2.end(), gs0.begin(), gs0.end(), std::back_inserter(diff));
+            store_basis_g6(vector<string>(diff.begin(), diff.end()), inputs);
+        }
+
+        int perm_sign(const Graph& G, const ScratchPermutation& p) const {
+            return kernels->perm_sign(G, p, even_edges);
+        }
+
+        string to_g6(const Graph& G) const {
+            return kernels->to_g6(G);
         }
 
         string to_string() const {
             return "KneisslerGVS(" + std::to_string(num_loops) + ", " +
                    std::to_string(kn_type) + ", " + get_type_string(even_edges) + ")";
         }
-
-        map<string, size_t> get_basis_dict() {
-            vector<string> g6s = get_basis_g6();
-            map<string, size_t> g6s_map;
-            for (size_t i = 0; i < g6s.size(); ++i) {
-                g6s_map[g6s[i]] = i;
-            }
-            return g6s_map;
-        }
 };
 
-class KneisslerContract {
+class KneisslerContract : public GraphOperator<KneisslerContract> {
     public:
 
     uint8_t num_loops;
@@ -413,70 +434,24 @@ class KneisslerContract {
             }
         }
 
-    string get_matrix_file_path(){
+    string get_matrix_file_path() const {
         return "data/kneissler/" + get_type_string(even_edges) +
                "/contractD" + std::to_string(num_loops) +
                "_" + std::to_string(kn_type) + ".txt";
     }
 
-    string get_ref_matrix_file_path() {
+    string get_ref_matrix_file_path() const {
         return "data/kneissler/ref/" + get_type_string(even_edges) +
                    "/contractD" + std::to_string(num_loops) +
                    "_" + std::to_string(kn_type) + ".txt";
     }
 
-    void build_matrix(bool ignore_existing_files = false) {
-        string fname = get_matrix_file_path();
-        ensure_folder_of_filename_exists(fname);
-        // exit if file exists and ignore_existing_files is false
-        if (!ignore_existing_files && std::ifstream(fname)) {
-            return;
+    // The contraction of the edges, one term per edge whose contraction gives a simple graph.
+    template <typename Emit>
+    void operate_on(const Graph& G, Emit&& emit) const {
+        for (const auto& [g1, sign] : domain.kernels->get_contractions_with_sign(G, even_edges)) {
+            emit(g1, sign);
         }
-        auto perms = all_permutations(num_loops - 1);
-        std::set<std::string> g6s;
-
-        cout << "Building matrix for contraction" << endl;
-
-        vector<string> in_basis = domain.get_basis_g6();
-        vector<string> out_basis = target.get_basis_g6();
-        map<string, size_t> in_basis_map;
-        map<string, size_t> out_basis_map;
-        map<pair<size_t, size_t>, int> matrix;
-        int num_rows = in_basis.size();
-        int num_cols = out_basis.size();
-
-        for (size_t i = 0; i < in_basis.size(); ++i) {
-            in_basis_map[in_basis[i]] = i;
-        }
-        for (size_t i = 0; i < out_basis.size(); ++i) {
-            out_basis_map[out_basis[i]] = i;
-        }
-
-         
-        for (const string s : in_basis) {
-            // cout << "******** Processing in element s: " << s << endl;
-            Graph g = Graph::from_g6(s);
-            auto v = g.get_contractions_with_sign(even_edges);
-            for (const auto& [g1, sign] : v) {
-                // cout << "g1 " << g1.to_g6() << " sgn " << sign << endl;
-                auto [g1s, sign2] = g1.to_canon_g6_sgn(even_edges);
-                // cout << "g1s " << g1s << " sgn2 " << sign2 << endl;
-                int val = sign * sign2;
-                if (out_basis_map.find(g1s) != out_basis_map.end()) {
-                    size_t row = in_basis_map[s];
-                    size_t col = out_basis_map[g1s];
-                    if (matrix.find({row, col}) != matrix.end()) {
-                        matrix[{row, col}] += val;
-                    } else {
-                        matrix[{row, col}] = val;
-                    }
-                    // cout << "++row " << row << " col " << col << " val " << val << " total " << matrix[{row, col}] << endl;
-                }
-            }
-        }
-        // save matrix to file
-        save_matrix_to_sms_file(matrix, num_rows, num_cols, fname);
-        cout << "Matrix saved to " << fname << endl;
     }
 
     string to_string() const {
@@ -491,38 +466,101 @@ class KneisslerContract {
 
 
 
-void test_basis_vs_ref(KneisslerGVS V) {
-    // test if the basis is correct
-    cout << "Checking basis correctness "<< V.to_string() << "..." << endl;  
-    vector<string> g6s = V.get_basis_g6();
-    string ref_fname = "data/kneissler/ref/" + get_type_string(V.even_edges) +
-                   "/gra" + std::to_string(V.num_loops) +
-                   "_" + std::to_string(V.kn_type) + ".g6";
-    cout << "Reference file: " << ref_fname << endl;
-    vector<string> ref_g6s = Graph::load_from_file(ref_fname);
-
-    // need to re-canonize reference basis
-    for (size_t i = 0; i < ref_g6s.size(); ++i) {
-        Graph g = Graph::from_g6(ref_g6s[i]);
-        auto g1s = g.to_canon_g6();
-        ref_g6s[i] = g1s;
-        // sanity checks
-        if (g.has_odd_automorphism(V.even_edges)) {
-            cout << "Reference graph has odd automorphism: " << g.to_g6() << endl;
+// Canonical forms of the graphs in a reference basis file, in file order.
+struct CanonicalReference {
+    vector<string> g6;
+    vector<int> sign;
+    vector<char> odd_automorphism;
+};
+
+// Recanonicalize a reference basis file in parallel. The result is cached in <ref_fname>.canon,
+// keyed by the checksum of the reference file, the parity and the canonicalizer version, so that
+// later runs only read the cache.
+CanonicalReference load_canonical_reference(const string& ref_fname, bool even_edges) {
+    string cache_fname = ref_fname + ".canon";
+    string key = "canon-cache 1 " + get_type_string(even_edges) + " " + canonicalizer_version() + " " +
+                 file_checksum(ref_fname);
+    CanonicalReference ref;
+
+    ifstream cache(cache_fname);
+    if (cache) {
+        string header;
+        std::getline(cache, header);
+        size_t count = 0;
+        if (header.rfind(key + " ", 0) == 0) {
+            count = std::stoul(header.substr(key.size() + 1));
+            string g6;
+            int sign, odd;
+            while (cache >> g6 >> sign >> odd) {
+                ref.g6.push_back(g6);
+                ref.sign.push_back(sign);
+                ref.odd_automorphism.push_back(odd);
+            }
+            if (ref.g6.size() == count) {
+                cout << "Using cached canonical reference " << cache_fname << endl;
+                return ref;
+            }
+            ref = CanonicalReference();
+        }
+    }
+
+    G6File ref_g6s(ref_fname);
+    size_t n = ref_g6s.size();
+    ref.g6.resize(n);
+    ref.sign.resize(n);
+    ref.odd_automorphism.resize(n);
+    ProgressReporter progress("canonicalize reference", n);
+    parallel_for(n, [&](size_t i, unsigned) {
+        CanonicalForm cf = Graph::from_g6(ref_g6s[i]).canonical_form(even_edges);
+        ref.g6[i] = std::move(cf.g6);
+        ref.sign[i] = cf.sign;
+        ref.odd_automorphism[i] = cf.odd_automorphism;
+        progress.inc();
+    });
+    progress.finish();
+
+    ofstream out(cache_fname);
+    if (out) {
+        out << key << " " << n << "\n";
+        for (size_t i = 0; i < n; ++i) {
+            out << ref.g6[i] << " " << ref.sign[i] << " " << (int)ref.odd_automorphism[i] << "\n";
         }
+    } else {
+        cerr << "Warning: could not write reference cache " << cache_fname << endl;
+    }
+    return ref;
+}
 
+// Report reference graphs with odd automorphisms (these should not be in a basis).
+void report_odd_reference_graphs(const CanonicalReference& ref) {
+    for (size_t i = 0; i < ref.g6.size(); ++i) {
+        if (ref.odd_automorphism[i]) {
+            cout << "Reference graph has odd automorphism: " << ref.g6[i] << endl;
+        }
     }
+}
+
+bool test_basis_vs_ref(const KneisslerGVS& V) {
+    // test if the basis is correct
+    cout << "Checking basis correctness "<< V.to_string() << "..." << endl;
+    vector<string> g6s = V.get_basis_g6();
+    string ref_fname = V.get_ref_basis_file_path();
+    cout << "Reference file: " << ref_fname << endl;
+    CanonicalReference ref = load_canonical_reference(ref_fname, V.even_edges);
+    report_odd_reference_graphs(ref);
 
-    // check whether the entries are the same
-    //std::sort(g6s.begin(), g6s.end());
+    // compare as sorted sets
+    vector<string> ref_g6s = ref.g6;
+    std::sort(g6s.begin(), g6s.end());
+    g6s.erase(std::unique(g6s.begin(), g6s.end()), g6s.end());
     std::sort(ref_g6s.begin(), ref_g6s.end());
-    std::set<string> g6s_set(g6s.begin(), g6s.end());
-    std::set<string> ref_g6s_set(ref_g6s.begin(), ref_g6s.end());
-    std::set<string> diff;
-    std::set_difference(g6s_set.begin(), g6s_set.end(),
-                        ref_g6s_set.begin(), ref_g6s_set.end(),
-                        std::inserter(diff, diff.begin()));
+    ref_g6s.erase(std::unique(ref_g6s.begin(), ref_g6s.end()), ref_g6s.end());
+
+    bool ok = true;
+    vector<string> diff;
+    std::set_difference(g6s.begin(), g6s.end(), ref_g6s.begin(), ref_g6s.end(), std::back_inserter(diff));
     if (diff.size() > 0) {
+        ok = false;
         cout << "The following graphs are in the basis but not in the reference:" << endl;
         for (const auto& g6 : diff) {
             cout << g6 << endl;
@@ -530,12 +568,10 @@ void test_basis_vs_ref(KneisslerGVS V) {
     } else {
         cout << "All graphs in the basis are in the reference" << endl;
     }
-    // check whether the entries are the same
     diff.clear();
-    std::set_difference(ref_g6s_set.begin(), ref_g6s_set.end(),
-                        g6s_set.begin(), g6s_set.end(),
-                        std::inserter(diff, diff.begin()));
+    std::set_difference(ref_g6s.begin(), ref_g6s.end(), g6s.begin(), g6s.end(), std::back_inserter(diff));
     if (diff.size() > 0) {
+        ok = false;
         cout << "The following graphs are in the reference but not in the basis:" << endl;
         for (const auto& g6 : diff) {
             cout << g6 << endl;
@@ -543,112 +579,90 @@ void test_basis_vs_ref(KneisslerGVS V) {
     } else {
         cout << "All graphs in the reference are in the basis" << endl;
     }
+    return ok;
 }
 
+// Map every reference basis element to its index in our basis (or -1 if it is missing).
+vector<long> reference_basis_permutation(const CanonicalReference& ref, const map<string, size_t>& basis_map,
+                                         const string& what) {
+    vector<long> perm(ref.g6.size(), -1);
+    for (size_t i = 0; i < ref.g6.size(); ++i) {
+        auto it = basis_map.find(ref.g6[i]);
+        if (it != basis_map.end()) {
+            perm[i] = it->second;
+        } else {
+            cout << "Error: " << ref.g6[i] << " not found in " << what << " basis" << endl;
+        }
+    }
+    return perm;
+}
 
-
-void test_matrix_vs_ref(KneisslerContract D) {
+bool test_matrix_vs_ref(const KneisslerContract& D) {
     // test if the matrix is correct
-    cout << "Checking matrix correctness "<< D.to_string() << "..." << endl;  
-    string ref_fname = "data/kneissler/ref/" + get_type_string(D.even_edges) +
-                   "/contractD" + std::to_string(D.num_loops) +
-                   "_" + std::to_string(D.kn_type) + ".txt";
+    cout << "Checking matrix correctness "<< D.to_string() << "..." << endl;
+    string ref_fname = D.get_ref_matrix_file_path();
     cout << "Reference file: " << ref_fname << endl;
-    int nrows_ref, ncols_ref;
-    map<pair<size_t, size_t>, int> ref_matrix = load_matrix_from_sms_file(ref_fname, nrows_ref, ncols_ref);
-    // load matrix from file
-    string fname = D.get_matrix_file_path();
-    int nrows, ncols;
-    map<pair<size_t, size_t>, int> matrix = load_matrix_from_sms_file(fname, nrows, ncols);
-    
-
-    // before comparing entries, we have to account for possibly different basis orderings.
-    // load the domain and tagert basis and the reference basis. canonize the reference basis and find the permutation
-    // then correct the matrix indices (rows and columns) accorind to the row- and column permutations
-    // get the domain and target basis
-    vector<string> in_basis = D.domain.get_basis_g6();
-    vector<string> out_basis = D.target.get_basis_g6();
-    map<string, size_t> in_basis_map = D.domain.get_basis_dict();
-    map<string, size_t> out_basis_map = D.target.get_basis_dict();
-    // get the reference basis
-    vector<string> in_basis_ref = Graph::load_from_file(D.domain.get_ref_basis_file_path());
-    vector<string> out_basis_ref = Graph::load_from_file(D.target.get_ref_basis_file_path());
-
-    // canonize the reference basis
-    vector<int> in_basis_ref_sgn(in_basis_ref.size());
-    for (size_t i = 0; i < in_basis_ref.size(); ++i) {
-        Graph g = Graph::from_g6(in_basis_ref[i]);
-        auto [g1s, sgn] = g.to_canon_g6_sgn(D.even_edges);
-        in_basis_ref[i] = g1s;
-        in_basis_ref_sgn[i] = sgn;
-
-        // sanity checks
-        if (g.has_odd_automorphism(D.even_edges)) {
-            cout << "Reference graph has odd automorphism: " << g.to_g6() << endl;
+    CsrMatrix ref_matrix = CsrMatrix::load_sms(ref_fname);
+    CsrMatrix matrix = CsrMatrix::load_sms(D.get_matrix_file_path());
+
+    if (matrix.nrows != ref_matrix.nrows || matrix.ncols != ref_matrix.ncols) {
+        cout << "Matrix dimensions are different: " << matrix.nrows << "x" << matrix.ncols << " vs "
+             << ref_matrix.nrows << "x" << ref_matrix.ncols << endl;
+        return false;
+    }
+
+    // Before comparing entries, we have to account for possibly different basis orderings and
+    // signs: canonize the reference bases, find their positions in our bases and transform the
+    // reference matrix accordingly.
+    CanonicalReference in_ref = load_canonical_reference(D.domain.get_ref_basis_file_path(), D.even_edges);
+    CanonicalReference out_ref = load_canonical_reference(D.target.get_ref_basis_file_path(), D.even_edges);
+    report_odd_reference_graphs(in_ref);
+    report_odd_reference_graphs(out_ref);
+    vector<long> in_perm = reference_basis_permutation(in_ref, D.domain.get_basis_dict(), "domain");
+    vector<long> out_perm = reference_basis_permutation(out_ref, D.target.get_basis_dict(), "target");
+    if (in_perm.size() != ref_matrix.nrows || out_perm.size() != ref_matrix.ncols) {
+        cout << "Reference bases do not match the reference matrix dimensions" << endl;
+        return false;
+    }
+
+    vector<MatrixEntry> entries;
+    entries.reserve(ref_matrix.nnz());
+    bool ok = true;
+    for (size_t r = 0; r < ref_matrix.nrows; ++r) {
+        for (size_t idx = ref_matrix.row_ptr[r]; idx < ref_matrix.row_ptr[r + 1]; ++idx) {
+            size_t c = ref_matrix.col_idx[idx];
+            if (in_perm[r] < 0 || out_perm[c] < 0) {
+                ok = false;
+                continue;
+            }
+            entries.push_back({(size_t)in_perm[r], (size_t)out_perm[c],
+                               ref_matrix.vals[idx] * in_ref.sign[r] * out_ref.sign[c]});
         }
     }
-    // canonize the target basis
-    vector<int> out_basis_ref_sgn(out_basis_ref.size());
-    for (size_t i = 0; i < out_basis_ref.size(); ++i) {
-        Graph g = Graph::from_g6(out_basis_ref[i]);
-        auto [g1s, sgn] = g.to_canon_g6_sgn(D.even_edges);
-        out_basis_ref[i] = g1s;
-        out_basis_ref_sgn[i] = sgn;
-        // sanity checks
-        if (g.has_odd_automorphism(D.even_edges)) {
-            cout << "Reference graph has odd automorphism: " << g.to_g6() << endl;
-        }
+    CsrMatrix matrix2 = CsrMatrix::from_entries(ref_matrix.nrows, ref_matrix.ncols, std::move(entries));
+
+    if (matrix.nnz() != matrix2.nnz()) {
+        cout << "Matrix number of entries are different: " << matrix.nnz() << " vs " << matrix2.nnz() << endl;
     }
-    // compute ref to normal basis permutations
-    vector<size_t> in_perm(in_basis_ref.size());
-    vector<size_t> out_perm(out_basis_ref.size());
-    for (size_t i = 0; i < in_basis_ref.size(); ++i) {
-        auto it = in_basis_map.find(in_basis_ref[i]);
-        if (it != in_basis_map.end()) {
-            in_perm[i] = it->second;
+    vector<pair<pair<size_t, size_t>, pair<int, int>>> diffs;
+    size_t num_diffs = csr_compare(matrix, matrix2, diffs);
+    for (const auto& [pos, v] : diffs) {
+        if (v.second == 0) {
+            cout << "Entry " << pos.first << " " << pos.second << " not found in ref matrix" << endl;
+        } else if (v.first == 0) {
+            cout << "Entry " << pos.first << " " << pos.second << " missing (ref value " << v.second << ")" << endl;
         } else {
-            cout << "Error: " << in_basis_ref[i] << " not found in domain basis" << endl;
+            cout << "Entry " << pos.first << " " << pos.second << " differs: " << v.second << " vs " << v.first << endl;
         }
     }
-    for (size_t i = 0; i < out_basis_ref.size(); ++i) {
-        auto it = out_basis_map.find(out_basis_ref[i]);
-        if (it != out_basis_map.end()) {
-            out_perm[i] = it->second;
-        } else {
-            cout << "Error: " << out_basis_ref[i] << " not found in target basis" << endl;
-        }
+    if (num_diffs > diffs.size()) {
+        cout << "... " << num_diffs - diffs.size() << " more differing entries" << endl;
     }
-    // now we have the permutations, we can correct the matrix indices
-    map<pair<size_t, size_t>, int> matrix2;
-    for (const auto& [key, value] : ref_matrix) {
-        size_t row = key.first;
-        size_t col = key.second;
-        // apply the permutations
-        row = in_perm[row];
-        col = out_perm[col];
-        matrix2[{row, col}] = value * in_basis_ref_sgn[key.first] * out_basis_ref_sgn[key.second];
-    }
-    // now we can compare the matrices
-    // check if the number of rows and columns are the same
-    if (nrows != nrows_ref || ncols != ncols_ref) {
-        cout << "Matrix dimensions are different: " << nrows << "x" << ncols << " vs " << nrows_ref << "x" << ncols_ref << endl;
-        return;
-    }
-    // check if the number of entries are the same
-    if (matrix.size() != matrix2.size()) {
-        cout << "Matrix number of entries are different: " << matrix.size() << " vs " << matrix2.size() << endl;
-        return;
-    }
-    // check whether the entries are the same
-    for (const auto& [key, value] : matrix) {
-        if (matrix2.find(key) == matrix2.end()) {
-            cout << "Entry " << key.first << " " << key.second << " not found in ref matrix" << endl;
-        } else if (matrix2[key] != value) {
-            cout << "Entry " << key.first << " " << key.second << " differs: " << matrix2[key] << " vs " << value << endl;
-        }
+    if (num_diffs == 0 && ok) {
+        cout << "Matrix agrees with the reference" << endl;
     }
-
+    return ok && num_diffs == 0;
 }
 
 
-#endif // KNEISSLER_HH
\ No newline at end of file
+#endif // KNEISSLER_HH
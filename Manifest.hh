@@ -0,0 +1,207 @@
+#ifndef MANIFEST_HH
+#define MANIFEST_HH
+
+#include "OutputFile.hh"
+#include "mygraphs.hh"
+
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+using namespace std;
+
+// Build manifests. Every data directory has a manifest.txt with one line per output file (basis,
+// matrix, rank or list of graphs): what it is, the generator and canonicalizer (with its library
+// version, see canonicalizer_version) that built it, its size and checksum, when it was built,
+// and the checksums of the files it was computed from. A task is skipped only if its output is
+// complete (see OutputFile) and was built by this generator and canonicalizer version, with the
+// same parameters, from inputs whose contents are still the same; so a rebuilt basis with new
+// contents also invalidates everything computed from it.
+
+// Recorded in the manifests. Bump it with every change that alters the contents of the outputs,
+// so that existing outputs are rebuilt.
+inline const string generator_version = "kneissler_gen-1";
+
+struct ManifestEntry {
+    string file;                    // name within the directory
+    string kind;                    // basis, matrix, rank or graphs
+    string params;                  // e.g. KneisslerGVS(8, 2, odd_edges)
+    string generator;
+    string canonicalizer;
+    uint64_t records = 0;           // dimension of a basis, nonzero entries of a matrix
+    string shape;                   // rows x cols of a matrix
+    string checksum;
+    long long built = 0;            // unix time
+    vector<pair<string, string>> inputs;  // (path, checksum)
+
+    string to_line() const {
+        string in;
+        for (const auto& [path, sum] : inputs) in += (in.empty() ? "" : ",") + path + "@" + sum;
+        return "file=" + file + "\tkind=" + kind + "\tparams=" + params + "\tgenerator=" + generator +
+               "\tcanonicalizer=" + canonicalizer + "\trecords=" + std::to_string(records) + "\tshape=" + shape +
+               "\tchecksum=" + checksum + "\tbuilt=" + std::to_string(built) + "\tinputs=" + in;
+    }
+
+    static ManifestEntry from_line(const string& line) {
+        ManifestEntry e;
+        std::istringstream fields(line);
+        string field;
+        while (std::getline(fields, field, '\t')) {
+            size_t eq = field.find('=');
+            if (eq == string::npos) throw std::runtime_error("Invalid manifest line: " + line);
+            string key = field.substr(0, eq), value = field.substr(eq + 1);
+            if (key == "file") e.file = value;
+            else if (key == "kind") e.kind = value;
+            else if (key == "params") e.params = value;
+            else if (key == "generator") e.generator = value;
+            else if (key == "canonicalizer") e.canonicalizer = value;
+            else if (key == "records") e.records = std::stoull(value);
+            else if (key == "shape") e.shape = value;
+            else if (key == "checksum") e.checksum = value;
+            else if (key == "built") e.built = std::stoll(value);
+            else if (key == "inputs") {
+                std::istringstream items(value);
+                string item;
+                while (std::getline(items, item, ',')) {
+                    size_t at = item.rfind('@');
+                    if (at == string::npos) throw std::runtime_error("Invalid manifest line: " + line);
+                    e.inputs.emplace_back(item.substr(0, at), item.substr(at + 1));
+                }
+            }
+        }
+        return e;
+    }
+};
+
+// The manifests of all data directories used by the process, loaded on first use. Updates are
+// written back at once (crash-safely, as OutputFile). Safe to use from the writer thread.
+class ManifestStore {
+    public:
+        bool find(const string& path, ManifestEntry& entry) {
+            auto [dir, name] = split_path(path);
+            std::lock_guard<std::mutex> lock(mtx);
+            const auto& entries = load(dir);
+            auto it = entries.find(name);
+            if (it == entries.end()) return false;
+            entry = it->second;
+            return true;
+        }
+
+        void record(const string& path, ManifestEntry entry) {
+            auto [dir, name] = split_path(path);
+            entry.file = name;
+            std::lock_guard<std::mutex> lock(mtx);
+            auto& entries = load(dir);
+            entries[name] = std::move(entry);
+            OutputFile out(manifest_path(dir));
+            out.write("# " + generator_version + " manifest\n");
+            for (const auto& [n, e] : entries) {
+                out.write(e.to_line());
+                out.write('\n');
+            }
+            out.commit(entries.size());
+        }
+
+    private:
+        std::mutex mtx;
+        map<string, map<string, ManifestEntry>> manifests;
+
+        static pair<string, string> split_path(const string& path) {
+            size_t pos = path.find_last_of('/');
+            if (pos == string::npos) return {".", path};
+            return {path.substr(0, pos), path.substr(pos + 1)};
+        }
+
+        static string manifest_path(const string& dir) {
+            return dir + "/manifest.txt";
+        }
+
+        map<string, ManifestEntry>& load(const string& dir) {
+            auto it = manifests.find(dir);
+            if (it != manifests.end()) return it->second;
+            auto& entries = manifests[dir];
+            ifstream file(manifest_path(dir));
+            string line;
+            while (std::getline(file, line)) {
+                if (line.empty() || line[0] == '#') continue;
+                ManifestEntry e = ManifestEntry::from_line(line);
+                entries[e.file] = std::move(e);
+            }
+            return entries;
+        }
+};
+
+inline ManifestStore& manifest_store() {
+    // never destroyed, the background writer may still record outputs at exit
+    static ManifestStore* store = new ManifestStore();
+    return *store;
+}
+
+// Checksum of the current contents of a file: from its sidecar if it is a complete output, else
+// computed; empty if the file does not exist.
+inline string current_checksum(const string& path) {
+    OutputSummary s;
+    if (output_complete(path) && load_output_summary(path, s)) return s.checksum;
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return "";
+    return file_checksum(path);
+}
+
+inline vector<pair<string, string>> input_checksums(const vector<string>& inputs) {
+    vector<pair<string, string>> result;
+    for (const auto& path : inputs) result.emplace_back(path, current_checksum(path));
+    return result;
+}
+
+// Whether the output file can be reused: complete, built by this generator and canonicalizer
+// version with these parameters from the current contents of the inputs. Prints why an existing
+// output is rebuilt.
+inline bool output_up_to_date(const string& path, const string& params, const vector<string>& inputs) {
+    if (!output_complete(path)) return false;
+    auto stale = [&](const string& reason) {
+        cout << "Rebuilding " << path << ": " << reason << endl;
+        return false;
+    };
+    ManifestEntry e;
+    if (!manifest_store().find(path, e)) return stale("not in the manifest");
+    if (e.generator != generator_version) return stale("built by " + e.generator);
+    if (e.canonicalizer != canonicalizer_version()) return stale("built with canonicalizer " + e.canonicalizer);
+    if (e.params != params) return stale("built for " + e.params);
+    OutputSummary s;
+    if (!load_output_summary(path, s) || s.checksum != e.checksum) return stale("changed since it was built");
+    if (e.inputs.size() != inputs.size()) return stale("inputs changed");
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (e.inputs[i].first != inputs[i] || e.inputs[i].second != current_checksum(inputs[i])) {
+            return stale(inputs[i] + " changed");
+        }
+    }
+    return true;
+}
+
+// Add the output file with the given summary (see OutputFile::commit) to its manifest, with the
+// checksums of the inputs it was computed from (see input_checksums).
+inline void record_output(const string& path, const string& kind, const string& params,
+                          const vector<pair<string, string>>& inputs, const OutputSummary& s, const string& shape = "") {
+    ManifestEntry e;
+    e.kind = kind;
+    e.params = params;
+    e.generator = generator_version;
+    e.canonicalizer = canonicalizer_version();
+    e.records = s.records;
+    e.shape = shape;
+    e.checksum = s.checksum;
+    e.built = static_cast<long long>(std::time(nullptr));
+    e.inputs = inputs;
+    manifest_store().record(path, std::move(e));
+}
+
+#endif // MANIFEST_HH
@@ -0,0 +1,320 @@
+#ifndef MODULARRANK_HH
+#define MODULARRANK_HH
+
+#include "SparseMatrix.hh"
+#include "parallel.hh"
+#include "progress.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Rank of sparse integer matrices modulo 32-bit primes.
+//
+// Structured Gaussian elimination: every round picks a set of pivots with small Markowitz cost
+// (row length - 1) * (column count - 1) whose pivot rows do not meet each other's pivot columns,
+// and eliminates the pivot columns from all other rows in parallel. Once the remaining active
+// part is small and dense enough it is finished by dense elimination.
+//
+// The rank modulo p is at most the rank over the rationals, and equal for all but finitely many
+// p, so the maximum over a few primes is the rational rank with overwhelming probability.
+
+// Largest primes below 2^32.
+inline const vector<uint32_t>& rank_primes() {
+    static const vector<uint32_t> primes = {4294967291u, 4294967279u, 4294967231u, 4294967197u,
+                                            4294967189u, 4294967161u, 4294967143u, 4294967111u};
+    return primes;
+}
+
+inline uint32_t mod_mul(uint32_t a, uint32_t b, uint32_t p) {
+    return static_cast<uint32_t>(static_cast<uint64_t>(a) * b % p);
+}
+
+inline uint32_t mod_pow(uint32_t a, uint64_t e, uint32_t p) {
+    uint32_t r = 1;
+    while (e > 0) {
+        if (e & 1) r = mod_mul(r, a, p);
+        a = mod_mul(a, a, p);
+        e >>= 1;
+    }
+    return r;
+}
+
+inline uint32_t mod_inv(uint32_t a, uint32_t p) {
+    if (a == 0) throw std::invalid_argument("mod_inv: zero has no inverse");
+    return mod_pow(a, p - 2, p);
+}
+
+inline uint32_t mod_reduce(long long v, uint32_t p) {
+    long long r = v % static_cast<long long>(p);
+    return static_cast<uint32_t>(r < 0 ? r + p : r);
+}
+
+// A sparse row modulo p: (column, value) with increasing columns and nonzero values.
+typedef vector<pair<uint32_t, uint32_t>> ModRow;
+
+// row - factor * pivot_row, modulo p.
+inline void mod_row_axpy(ModRow& row, const ModRow& pivot_row, uint32_t factor, uint32_t p, ModRow& tmp) {
+    tmp.clear();
+    uint32_t neg = factor == 0 ? 0 : p - factor;
+    size_t i = 0, j = 0;
+    while (i < row.size() || j < pivot_row.size()) {
+        if (j == pivot_row.size() || (i < row.size() && row[i].first < pivot_row[j].first)) {
+            tmp.push_back(row[i++]);
+        } else if (i == row.size() || pivot_row[j].first < row[i].first) {
+            tmp.emplace_back(pivot_row[j].first, mod_mul(pivot_row[j].second, neg, p));
+            ++j;
+        } else {
+            uint64_t v = (static_cast<uint64_t>(row[i].second) + mod_mul(pivot_row[j].second, neg, p)) % p;
+            if (v != 0) tmp.emplace_back(row[i].first, static_cast<uint32_t>(v));
+            ++i;
+            ++j;
+        }
+    }
+    row.swap(tmp);
+}
+
+// Rank of a dense matrix (row-major, rows x cols) modulo p. The matrix is destroyed.
+// Pivots are taken in panels of up to panel_size rows: the next rows are reduced serially by the
+// pivots of the panel so far, rows that vanish are dropped and the others become pivots (scaled
+// to 1 in their pivot column). Then one parallel pass eliminates the whole panel from all other
+// rows, so there is one parallel_for per panel instead of one per pivot.
+inline size_t dense_modular_rank(vector<uint32_t>& a, size_t rows, size_t cols, uint32_t p) {
+    constexpr size_t panel_size = 64;
+    // below this many rows to update a pass runs on the calling thread
+    constexpr size_t min_parallel_rows = 256;
+    // r -= r[c] * prow, for a pivot row with prow[c] == 1
+    auto eliminate = [&](uint32_t* r, const uint32_t* prow, size_t c) {
+        if (r[c] == 0) return;
+        uint32_t f = p - r[c];
+        for (size_t j = 0; j < cols; ++j) {
+            if (prow[j] != 0) r[j] = static_cast<uint32_t>((r[j] + static_cast<uint64_t>(prow[j]) * f) % p);
+        }
+    };
+    size_t rank = 0;
+    size_t active = rows;   // rows [rank, active) are left, the others are pivots or zero
+    vector<size_t> pivot_cols;
+    while (rank < active) {
+        pivot_cols.clear();
+        while (pivot_cols.size() < panel_size && rank + pivot_cols.size() < active) {
+            uint32_t* r = &a[(rank + pivot_cols.size()) * cols];
+            for (size_t k = 0; k < pivot_cols.size(); ++k) eliminate(r, &a[(rank + k) * cols], pivot_cols[k]);
+            size_t c = 0;
+            while (c < cols && r[c] == 0) ++c;
+            if (c == cols) {
+                --active;
+                std::swap_ranges(r, r + cols, a.begin() + active * cols);
+                continue;
+            }
+            uint32_t inv = mod_inv(r[c], p);
+            for (size_t j = c; j < cols; ++j) r[j] = mod_mul(r[j], inv, p);
+            pivot_cols.push_back(c);
+        }
+        size_t first = rank + pivot_cols.size();
+        size_t n = active - first;
+        parallel_for(n, [&](size_t i, unsigned) {
+            uint32_t* r = &a[(first + i) * cols];
+            for (size_t k = 0; k < pivot_cols.size(); ++k) eliminate(r, &a[(rank + k) * cols], pivot_cols[k]);
+        }, n < min_parallel_rows ? 1 : 0);
+        rank = first;
+    }
+    return rank;
+}
+
+// Rank of m modulo the prime p (p < 2^32).
+inline size_t modular_rank(const CsrMatrix& m, uint32_t p) {
+    vector<ModRow> rows;
+    rows.reserve(m.nrows);
+    for (size_t r = 0; r < m.nrows; ++r) {
+        ModRow row;
+        for (size_t i = m.row_ptr[r]; i < m.row_ptr[r + 1]; ++i) {
+            uint32_t v = mod_reduce(m.vals[i], p);
+            if (v != 0) row.emplace_back(static_cast<uint32_t>(m.col_idx[i]), v);
+        }
+        if (!row.empty()) rows.push_back(std::move(row));
+    }
+
+    size_t rank = 0;
+    vector<size_t> col_count(m.ncols);
+    vector<char> is_pivot_col(m.ncols), touched(m.ncols);
+    vector<ModRow> tmps(parallel_num_threads());
+    ProgressReporter progress("rank mod " + std::to_string(p), std::min(m.nrows, m.ncols));
+
+    while (!rows.empty()) {
+        // switch to dense elimination for a small, dense remainder
+        size_t nnz = 0;
+        std::fill(col_count.begin(), col_count.end(), 0);
+        for (const auto& row : rows) {
+            nnz += row.size();
+            for (const auto& e : row) col_count[e.first]++;
+        }
+        size_t active_cols = m.ncols - std::count(col_count.begin(), col_count.end(), 0);
+        double cells = static_cast<double>(rows.size()) * active_cols;
+        if (cells <= 64e6 && nnz >= 0.05 * cells) {
+            vector<uint32_t> col_map(m.ncols);
+            size_t c = 0;
+            for (size_t j = 0; j < m.ncols; ++j) {
+                if (col_count[j] > 0) col_map[j] = c++;
+            }
+            size_t num_rows = rows.size();
+            vector<uint32_t> dense(num_rows * active_cols, 0);
+            for (size_t r = 0; r < num_rows; ++r) {
+                for (const auto& e : rows[r]) dense[r * active_cols + col_map[e.first]] = e.second;
+            }
+            vector<ModRow>().swap(rows);
+            rank += dense_modular_rank(dense, num_rows, active_cols, p);
+            break;
+        }
+
+        // candidate pivot of each row: the entry in its sparsest column
+        vector<pair<uint64_t, size_t>> candidates(rows.size());
+        vector<uint32_t> pivot_col(rows.size());
+        for (size_t r = 0; r < rows.size(); ++r) {
+            size_t best = 0;
+            for (size_t i = 1; i < rows[r].size(); ++i) {
+                if (col_count[rows[r][i].first] < col_count[rows[r][best].first]) best = i;
+            }
+            pivot_col[r] = rows[r][best].first;
+            uint64_t cost = static_cast<uint64_t>(rows[r].size() - 1) * (col_count[pivot_col[r]] - 1);
+            candidates[r] = {cost, r};
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        // greedy independent pivot set, allowing a bounded amount of fill-in per round
+        uint64_t max_cost = 4 * candidates.front().first + 16;
+        vector<size_t> pivots;
+        vector<char> is_pivot_row(rows.size(), 0);
+        for (const auto& [cost, r] : candidates) {
+            if (cost > max_cost) break;
+            uint32_t c = pivot_col[r];
+            if (touched[c]) continue;
+            bool independent = true;
+            for (const auto& e : rows[r]) {
+                if (is_pivot_col[e.first]) {
+                    independent = false;
+                    break;
+                }
+            }
+            if (!independent) continue;
+            is_pivot_col[c] = 1;
+            for (const auto& e : rows[r]) touched[e.first] = 1;
+            is_pivot_row[r] = 1;
+            pivots.push_back(r);
+        }
+
+        // the pivot rows in pivot_of[column], scaled to have a 1 in their pivot column
+        vector<long> pivot_of(m.ncols, -1);
+        for (size_t r : pivots) {
+            uint32_t c = pivot_col[r];
+            pivot_of[c] = r;
+            uint32_t inv = mod_inv(std::lower_bound(rows[r].begin(), rows[r].end(), make_pair(c, 0u))->second, p);
+            for (auto& e : rows[r]) e.second = mod_mul(e.second, inv, p);
+        }
+
+        // the pivot submatrix is diagonal, so every other row is reduced independently
+        parallel_for(rows.size(), [&](size_t r, unsigned tid) {
+            if (is_pivot_row[r]) return;
+            ModRow& row = rows[r];
+            vector<pair<uint32_t, uint32_t>> hits;
+            for (const auto& e : row) {
+                if (is_pivot_col[e.first]) hits.push_back(e);
+            }
+            for (const auto& [c, v] : hits) {
+                mod_row_axpy(row, rows[pivot_of[c]], v, p, tmps[tid]);
+            }
+        });
+
+        rank += pivots.size();
+        progress.inc(pivots.size());
+        for (size_t r : pivots) {
+            for (const auto& e : rows[r]) touched[e.first] = 0;
+            is_pivot_col[pivot_col[r]] = 0;
+        }
+        vector<ModRow> remaining;
+        remaining.reserve(rows.size() - pivots.size());
+        for (size_t r = 0; r < rows.size(); ++r) {
+            if (!is_pivot_row[r] && !rows[r].empty()) remaining.push_back(std::move(rows[r]));
+        }
+        rows.swap(remaining);
+    }
+    progress.finish();
+    return rank;
+}
+
+// Product a * b modulo p by row-wise sparse matrix multiplication: rows of a are processed in
+// parallel, each thread with a dense accumulator over the columns of b. Entries are stored as
+// their representatives in (-p/2, p/2].
+inline CsrMatrix csr_product_mod(const CsrMatrix& a, const CsrMatrix& b, uint32_t p) {
+    if (a.ncols != b.nrows) {
+        throw std::invalid_argument("csr_product_mod: inner dimensions differ");
+    }
+    struct Accumulator {
+        vector<uint32_t> val;
+        vector<char> used;
+        vector<uint32_t> touched;
+    };
+    vector<Accumulator> accs(parallel_num_threads());
+    vector<vector<pair<size_t, int>>> rows(a.nrows);
+    parallel_for(a.nrows, [&](size_t i, unsigned tid) {
+        Accumulator& acc = accs[tid];
+        if (acc.val.empty()) {
+            acc.val.assign(b.ncols, 0);
+            acc.used.assign(b.ncols, 0);
+        }
+        for (size_t x = a.row_ptr[i]; x < a.row_ptr[i + 1]; ++x) {
+            uint32_t v = mod_reduce(a.vals[x], p);
+            size_t j = a.col_idx[x];
+            for (size_t y = b.row_ptr[j]; y < b.row_ptr[j + 1]; ++y) {
+                size_t k = b.col_idx[y];
+                if (!acc.used[k]) {
+                    acc.used[k] = 1;
+                    acc.touched.push_back(k);
+                }
+                acc.val[k] = static_cast<uint32_t>((acc.val[k] + static_cast<uint64_t>(v) * mod_reduce(b.vals[y], p)) % p);
+            }
+        }
+        std::sort(acc.touched.begin(), acc.touched.end());
+        for (uint32_t k : acc.touched) {
+            uint32_t v = acc.val[k];
+            if (v != 0) rows[i].emplace_back(k, v > p / 2 ? static_cast<int>(static_cast<long long>(v) - p) : static_cast<int>(v));
+            acc.val[k] = 0;
+            acc.used[k] = 0;
+        }
+        acc.touched.clear();
+    });
+    CsrMatrix m(a.nrows, b.ncols);
+    for (size_t i = 0; i < a.nrows; ++i) {
+        m.row_ptr[i + 1] = m.row_ptr[i] + rows[i].size();
+        for (const auto& [k, v] : rows[i]) {
+            m.col_idx.push_back(k);
+            m.vals.push_back(v);
+        }
+    }
+    return m;
+}
+
+struct RankResult {
+    size_t rank = 0;                               // maximum over the primes
+    vector<pair<uint32_t, size_t>> per_prime;      // (prime, rank modulo prime)
+};
+
+// Rank of m modulo the first num_primes primes of rank_primes().
+inline RankResult multi_prime_rank(const CsrMatrix& m, size_t num_primes = 1) {
+    const auto& primes = rank_primes();
+    if (num_primes < 1 || num_primes > primes.size()) {
+        throw std::invalid_argument("Number of primes must be between 1 and " + std::to_string(primes.size()));
+    }
+    RankResult result;
+    for (size_t i = 0; i < num_primes; ++i) {
+        size_t r = modular_rank(m, primes[i]);
+        result.per_prime.emplace_back(primes[i], r);
+        result.rank = std::max(result.rank, r);
+    }
+    return result;
+}
+
+#endif // MODULARRANK_HH
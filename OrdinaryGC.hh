@@ -2,40 +2,375 @@
 #define ORDINARYGC_HH
 
 #include "mygraphs.hh"
+#include "GraphVectorSpace.hh"
+#include "GraphOperator.hh"
+#include "CanonicalAugmentation.hh"
+#include "parallel.hh"
 
-string get_type_string(bool even_edges) {
-    return even_edges ? "even_edges" : "odd_edges";
-}
+#include <algorithm>
+#include <string>
+#include <map>
+#include <fstream>
+#include <memory>
+#include <vector>
 
-class OrdinaryGVS {
+using namespace std;
+
+// Graphs with num_vertices vertices and loop order num_loops, all vertices at least trivalent.
+// The defect d = 2*loops - 2 - vertices is the excess valence; defect 0 graphs are trivalent.
+class OrdinaryGVS : public GraphVectorSpace<OrdinaryGVS> {
     public:
         uint8_t num_vertices;
         uint8_t num_loops;
         bool even_edges;
 
+        // Generate the lists of all graphs by canonical augmentation instead of deduplicating
+        // canonical forms (e.g. --orderly).
+        static inline bool orderly_generation = false;
+
+        // Reductions, inverse to the generating operations
+        static constexpr uint8_t reduce_edge = 0;    // remove an edge and smooth its ends (add_edge_across)
+        static constexpr uint8_t reduce_tetra = 1;   // replace a diamond by an edge (replace_edge_by_tetra)
+        static constexpr uint8_t reduce_split = 2;   // split a vertex by a new edge (contract_edge)
+
         OrdinaryGVS(uint8_t n, uint8_t loops, bool even)
             : num_vertices(n), num_loops(loops), even_edges(even) {}
-        
-        string get_basis_file_path(){
+
+        int get_defect() const {
+            return 2 * num_loops - 2 - num_vertices;
+        }
+
+        size_t get_num_edges() const {
+            return num_vertices + num_loops - 1;
+        }
+
+        bool is_valid() const {
+            if (num_loops < 3 || num_vertices < 1 || get_defect() < 0) return false;
+            return static_cast<size_t>(num_vertices) * (num_vertices - 1) / 2 >= get_num_edges();
+        }
+
+        string get_basis_file_path() const {
             return "data/ordinary/" + get_type_string(even_edges) +
                    "/gra" + std::to_string(num_vertices) +
                    "_" + std::to_string(num_loops) + ".g6";
         }
-        string get_input_file_path(){
-            return "data/ordinary/" + get_type_string(even_edges) +
-                   "/gra" + std::to_string(num_vertices) +
-                   "_" + std::to_string(num_loops) + ".txt";
+
+        // All isomorphism classes of graphs in this space, with or without odd automorphisms.
+        // Independent of the parity; the bases of both parities are filtered from it.
+        string get_input_file_path() const {
+            return "data/ordinary/all/gra" + std::to_string(num_vertices) +
+                   "_" + std::to_string(num_loops) + ".g6";
+        }
+
+        string to_string() const {
+            return "OrdinaryGVS(" + std::to_string(num_vertices) + ", " +
+                   std::to_string(num_loops) + ", " + get_type_string(even_edges) + ")";
+        }
+
+        // The spaces whose lists of all graphs build_all_graphs starts from.
+        vector<OrdinaryGVS> get_all_graphs_sources() const {
+            vector<OrdinaryGVS> spaces;
+            if (get_defect() > 0) {
+                spaces.emplace_back(num_vertices + 1, num_loops, false);
+            } else {
+                for (int l1 = 3; l1 + 3 <= num_loops; ++l1) {
+                    int l2 = num_loops - l1;
+                    if (l1 < l2) continue;
+                    spaces.emplace_back(2 * l1 - 2, l1, false);
+                    spaces.emplace_back(2 * l2 - 2, l2, false);
+                }
+                if (num_loops >= 5) spaces.emplace_back(2 * num_loops - 6, num_loops - 2, false);
+                if (num_loops > 3) spaces.emplace_back(2 * num_loops - 4, num_loops - 1, false);
+            }
+            spaces.erase(std::remove_if(spaces.begin(), spaces.end(), [](const OrdinaryGVS& V) { return !V.is_valid(); }),
+                         spaces.end());
+            return spaces;
+        }
+
+        // Generate the list of all graphs in this space, canonicalized and deduplicated in
+        // process, or with orderly_generation by canonical augmentation. Defect 0 graphs come
+        // from lower loop orders by joining two graphs by an edge, replacing an edge by a
+        // tetrahedron, or adding an edge across two edges; higher defects by contracting an edge
+        // of a graph of one defect less. Missing inputs are built first. Skipped if the list is
+        // up to date with its inputs (see output_up_to_date).
+        void build_all_graphs(bool ignore_existing_files = false) const {
+            if (!is_valid()) {
+                return;
+            }
+            string fname = get_input_file_path();
+            vector<string> inputs;
+            for (const auto& V : get_all_graphs_sources()) {
+                inputs.push_back(V.get_input_file_path());
+            }
+            if (!ignore_existing_files) {
+                // the inputs must be current before their checksums are compared
+                for (const auto& V : get_all_graphs_sources()) {
+                    V.build_all_graphs();
+                }
+                if (output_up_to_date(fname, get_all_graphs_params(), inputs)) {
+                    return;
+                }
+            }
+            cout << "Generating all graphs for " << fname << endl;
+            ensure_folder_of_filename_exists(fname);
+            // all steps feed one dedup set, spilled next to the output under a memory budget;
+            // canonical augmentation produces no duplicates, so its codes need no hash sets
+            G6DedupSet g6s(fname);
+            G6DistinctSet orderly_g6s(fname);
+            auto canon = [](const Graph& g) { return CanonicalForm{g.to_canon_g6()}; };
+            int loops = num_loops;
+            bool trivalent = get_defect() == 0;
+            auto reductions_of = [loops, trivalent](const Graph& g) {
+                return trivalent ? cubic_reductions(g, loops) : split_reductions(g);
+            };
+            // generate(i, emit) passes (child, reduction undoing the operation) to emit
+            auto collect = [&](size_t n, const string& label, auto&& generate) {
+                if (orderly_generation) {
+                    collect_orderly_g6(n, label, generate, reductions_of, orderly_g6s);
+                } else {
+                    collect_canonical_g6(
+                        n, label,
+                        [&](size_t i, auto&& emit) { generate(i, [&](const Graph& G, const Reduction&) { emit(G); }); },
+                        canon, false, g6s);
+                }
+            };
+
+            if (get_defect() > 0) {
+                vector<Graph> parents = load_all_graphs(num_vertices + 1, num_loops);
+                size_t num_edges = get_num_edges();
+                collect(parents.size(), "contract edges", [&](size_t i, auto&& emit) {
+                    const Graph& g = parents[i];
+                    for (size_t eidx = 0; eidx < g.edges.size(); ++eidx) {
+                        Graph gg = g.contract_edge(eidx);
+                        // contractions creating multiple edges leave the space
+                        if (gg.edges.size() == num_edges) emit(gg, contraction_reduction(g, eidx));
+                    }
+                });
+            } else {
+                if (num_loops == 3) {
+                    string g6 = Graph::tetrahedron_graph().to_canon_g6();
+                    if (orderly_generation) {
+                        orderly_g6s.insert(0, std::move(g6));
+                    } else {
+                        g6s.insert(0, std::move(g6));
+                    }
+                }
+                // connect two components by an edge
+                for (int l1 = 3; l1 + 3 <= num_loops; ++l1) {
+                    int l2 = num_loops - l1;
+                    if (l1 < l2) continue;
+                    vector<Graph> gs1 = load_all_graphs(2 * l1 - 2, l1);
+                    vector<Graph> gs2 = load_all_graphs(2 * l2 - 2, l2);
+                    collect(gs1.size() * gs2.size(), "join components", [&](size_t i, auto&& emit) {
+                        size_t i1 = i / gs2.size(), i2 = i % gs2.size();
+                        // the union is symmetric for components of the same loop order
+                        if (l1 == l2 && i2 < i1) return;
+                        const Graph& g1 = gs1[i1];
+                        const Graph& g2 = gs2[i2];
+                        Graph gg = g1.union_with(g2);
+                        Reduction r(reduce_edge, {{gg.num_vertices, static_cast<uint8_t>(gg.num_vertices + 1)}});
+                        size_t e1 = g1.edges.size();
+                        for (size_t a = 0; a < e1; ++a) {
+                            for (size_t b = 0; b < g2.edges.size(); ++b) {
+                                emit(gg.add_edge_across(a, b + e1), r);
+                            }
+                        }
+                    });
+                }
+                // replace an edge by a tetrahedron
+                if (num_loops >= 5) {
+                    vector<Graph> gs = load_all_graphs(2 * num_loops - 6, num_loops - 2);
+                    collect(gs.size(), "add tetrahedra", [&](size_t i, auto&& emit) {
+                        // the middle edge of the new diamond
+                        Reduction r(reduce_tetra, {{static_cast<uint8_t>(gs[i].num_vertices + 1),
+                                                    static_cast<uint8_t>(gs[i].num_vertices + 2)}});
+                        for (size_t eidx = 0; eidx < gs[i].edges.size(); ++eidx) {
+                            emit(gs[i].replace_edge_by_tetra(eidx), r);
+                        }
+                    });
+                }
+                // add an edge across two edges
+                if (num_loops > 3) {
+                    vector<Graph> gs = load_all_graphs(2 * num_loops - 4, num_loops - 1);
+                    collect(gs.size(), "connect edges", [&](size_t i, auto&& emit) {
+                        size_t ee = gs[i].edges.size();
+                        Reduction r(reduce_edge, {{gs[i].num_vertices, static_cast<uint8_t>(gs[i].num_vertices + 1)}});
+                        for (size_t a = 0; a < ee; ++a) {
+                            for (size_t b = a + 1; b < ee; ++b) {
+                                emit(gs[i].add_edge_across(a, b), r);
+                            }
+                        }
+                    });
+                }
+            }
+
+            SortedG6List all = orderly_generation ? orderly_g6s.finish() : g6s.finish();
+            cout << all.size() << " graphs generated" << endl;
+            string params = get_all_graphs_params();
+            auto sums = input_checksums(inputs);
+            Graph::save_to_file_async(std::move(all), fname, [fname, params, sums](const OutputSummary& s) {
+                record_output(fname, "graphs", params, sums, s);
+            });
+        }
+
+        // Reductions of a trivalent graph with the given loop order whose results are in the
+        // lists of all graphs of lower loop order: edges whose removal (smoothing the two
+        // bivalent ends) leaves a simple graph, connected or with two trivalent components, and
+        // middle edges of diamonds whose replacement by an edge leaves a simple graph.
+        static vector<Reduction> cubic_reductions(const Graph& g, int loops) {
+            vector<uint64_t> adj(g.num_vertices, 0);
+            vector<vector<uint8_t>> nbrs(g.num_vertices);
+            for (const auto& e : g.edges) {
+                adj[e.u] |= uint64_t(1) << e.v;
+                adj[e.v] |= uint64_t(1) << e.u;
+                nbrs[e.u].push_back(e.v);
+                nbrs[e.v].push_back(e.u);
+            }
+            auto adjacent = [&](uint8_t a, uint8_t b) { return ((adj[a] >> b) & 1) != 0; };
+            // the two neighbors of x other than y
+            auto others = [&](uint8_t x, uint8_t y) {
+                uint8_t o[2], k = 0;
+                for (uint8_t w : nbrs[x]) {
+                    if (w != y && k < 2) o[k++] = w;
+                }
+                return std::make_pair(o[0], o[1]);
+            };
+            vector<Reduction> res;
+            for (const auto& e : g.edges) {
+                auto [a, b] = others(e.u, e.v);
+                auto [c, d] = others(e.v, e.u);
+                bool same = (a == c && b == d) || (a == d && b == c);
+                if (!same && !adjacent(a, b) && !adjacent(c, d)) {
+                    res.emplace_back(reduce_edge, vector<vector<uint8_t>>{{e.u, e.v}});
+                }
+                if (loops < 5) continue;
+                uint64_t common = adj[e.u] & adj[e.v];
+                if (__builtin_popcountll(common) != 2) continue;
+                uint8_t v1 = __builtin_ctzll(common);
+                uint8_t v4 = 63 - __builtin_clzll(common);
+                if (adjacent(v1, v4)) continue;
+                uint8_t p = 0, q = 0;
+                for (uint8_t w : nbrs[v1]) {
+                    if (w != e.u && w != e.v) p = w;
+                }
+                for (uint8_t w : nbrs[v4]) {
+                    if (w != e.u && w != e.v) q = w;
+                }
+                if (p != q && !adjacent(p, q)) {
+                    res.emplace_back(reduce_tetra, vector<vector<uint8_t>>{{e.u, e.v}});
+                }
+            }
+            return res;
         }
 
-        void build_basis(bool ignore_existing_files = false) {
-            string infile = get_input_file_path();
-            // check if 
+        // Reductions of a graph of positive defect: all ways to split a vertex of valence >= 4 into
+        // two vertices of valence >= 3 joined by a new edge.
+        static vector<Reduction> split_reductions(const Graph& g) {
+            vector<vector<uint8_t>> nbrs(g.num_vertices);
+            for (const auto& e : g.edges) {
+                nbrs[e.u].push_back(e.v);
+                nbrs[e.v].push_back(e.u);
+            }
+            vector<Reduction> res;
+            for (uint8_t w = 0; w < g.num_vertices; ++w) {
+                const auto& nb = nbrs[w];
+                size_t k = nb.size();
+                if (k < 4) continue;
+                // subsets containing nb[0], so that each split is listed once
+                for (uint32_t mask = 1; mask < (uint32_t(1) << k); mask += 2) {
+                    int size = __builtin_popcount(mask);
+                    if (size < 2 || static_cast<size_t>(size) > k - 2) continue;
+                    vector<uint8_t> s, t;
+                    for (size_t j = 0; j < k; ++j) ((mask >> j) & 1 ? s : t).push_back(nb[j]);
+                    res.emplace_back(reduce_split, vector<vector<uint8_t>>{{w}, s, t});
+                }
+            }
+            return res;
+        }
+
+        // The split of g.contract_edge(eidx) that undoes the contraction.
+        static Reduction contraction_reduction(const Graph& g, size_t eidx) {
+            auto [u, v, data] = g.edges[eidx];
+            auto image = [&](uint8_t a) -> uint8_t { return a < v ? a : (a == v ? u : a - 1); };
+            vector<uint8_t> s, t;
+            for (const auto& e : g.edges) {
+                if (e.u == u && e.v != v) s.push_back(image(e.v));
+                if (e.v == u && e.u != v) s.push_back(image(e.u));
+                if (e.u == v && e.v != u) t.push_back(image(e.v));
+                if (e.v == v && e.u != u) t.push_back(image(e.u));
+            }
+            return Reduction(reduce_split, {{u}, s, t});
+        }
+
+        // The basis is filtered from the list of all graphs.
+        vector<string> get_basis_inputs() const {
+            return {get_input_file_path()};
+        }
+
+        void prepare_inputs(bool ignore_existing_files) const {
+            build_all_graphs(ignore_existing_files);
+        }
+
+        // The basis is filtered from the list of all graphs, one work item per graph.
+        void prepare_generators() {
+            generating_g6s = std::make_shared<G6File>(get_input_file_path());
+        }
+
+        size_t get_num_generators() const {
+            return generating_g6s ? generating_g6s->size() : 0;
+        }
+
+        template <typename Emit>
+        void generate(size_t i, Emit&& emit) const {
+            emit(Graph::from_g6((*generating_g6s)[i]));
+        }
+
+    private:
+        // shared, so that the space stays copyable
+        shared_ptr<const G6File> generating_g6s;
+
+        string get_all_graphs_params() const {
+            return "OrdinaryGraphs(" + std::to_string(num_vertices) + ", " + std::to_string(num_loops) + ")";
+        }
 
+        // Load (building it first if necessary) the list of all graphs of another space.
+        static vector<Graph> load_all_graphs(int n, int loops) {
+            OrdinaryGVS other(n, loops, false);
+            if (!other.is_valid()) return {};
+            other.build_all_graphs();
+            return Graph::load_graphs_from_file(other.get_input_file_path());
         }
-}
+};
+
+// Edge contraction D: OrdinaryGVS(n, l) -> OrdinaryGVS(n - 1, l), raising the defect by one.
+class OrdinaryContract : public GraphOperator<OrdinaryContract> {
+    public:
+        OrdinaryGVS domain;
+        OrdinaryGVS target;
+        bool even_edges;
+
+        OrdinaryContract(uint8_t n, uint8_t loops, bool even)
+            : domain(n, loops, even), target(n - 1, loops, even), even_edges(even) {}
 
+        string get_matrix_file_path() const {
+            return "data/ordinary/" + get_type_string(even_edges) +
+                   "/contractD" + std::to_string(domain.num_vertices) +
+                   "_" + std::to_string(domain.num_loops) + ".txt";
+        }
 
+        string to_string() const {
+            return "OrdinaryContract(" + std::to_string(domain.num_vertices) + ", " +
+                   std::to_string(domain.num_loops) + ", " + get_type_string(even_edges) + ")";
+        }
 
+        // Contractions creating multiple edges vanish and are skipped by get_contractions_with_sign.
+        template <typename Emit>
+        void operate_on(const Graph& G, Emit&& emit) const {
+            for (const auto& [g1, sign] : G.get_contractions_with_sign(even_edges)) {
+                emit(g1, sign);
+            }
+        }
+};
 
 
-#endif // ORDINARYGC_HH
\ No newline at end of file
+#endif // ORDINARYGC_HH
@@ -0,0 +1,314 @@
+#ifndef OUTPUTFILE_HH
+#define OUTPUTFILE_HH
+
+#include "instrument.hh"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Crash-safe output files. An OutputFile writes to <name>.tmp.<pid>. commit() fsyncs the
+// temporary file, renames it over <name> and then writes the sidecar <name>.sum with the number
+// of records, the size and the FNV-1a checksum of the contents, which is renamed into place in
+// the same way. A file only counts as finished (output_complete) when its sidecar exists and
+// agrees with its size, so a file cut short by a crash is rebuilt rather than used.
+
+// 64-bit FNV-1a hash, continued from h.
+inline uint64_t fnv1a64(const char* data, size_t n, uint64_t h = 1469598103934665603ULL) {
+    for (size_t i = 0; i < n; ++i) {
+        h ^= static_cast<uint8_t>(data[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline string checksum_hex(uint64_t h) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)h);
+    return hex;
+}
+
+// Hex string of the 64-bit FNV-1a hash of a file's contents.
+inline string file_checksum(const string& filename) {
+    ifstream file(filename, std::ios::binary);
+    if (!file) throw std::runtime_error("Failed to open file for reading: " + filename);
+    uint64_t h = fnv1a64(nullptr, 0);
+    char buf[1 << 16];
+    while (file) {
+        file.read(buf, sizeof(buf));
+        h = fnv1a64(buf, static_cast<size_t>(file.gcount()), h);
+    }
+    return checksum_hex(h);
+}
+
+inline string output_sidecar_path(const string& filename) {
+    return filename + ".sum";
+}
+
+struct OutputSummary {
+    uint64_t records = 0;
+    uint64_t bytes = 0;
+    string checksum;
+};
+
+// The sidecar of filename; false if there is none or it cannot be parsed.
+inline bool load_output_summary(const string& filename, OutputSummary& s) {
+    ifstream file(output_sidecar_path(filename));
+    string k1, k2, k3;
+    return static_cast<bool>(file >> k1 >> s.records >> k2 >> s.bytes >> k3 >> s.checksum) &&
+           k1 == "records" && k2 == "bytes" && k3 == "fnv1a64";
+}
+
+class OutputFile {
+    public:
+        explicit OutputFile(const string& filename_)
+            : filename(filename_), tmp_name(filename_ + ".tmp." + std::to_string(::getpid())) {
+            fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) throw std::runtime_error("Failed to open file for writing: " + tmp_name);
+            buf.reserve(buffer_size);
+        }
+
+        ~OutputFile() {
+            // not committed: drop the partial file
+            if (fd >= 0) {
+                ::close(fd);
+                ::unlink(tmp_name.c_str());
+            }
+        }
+
+        OutputFile(const OutputFile&) = delete;
+        OutputFile& operator=(const OutputFile&) = delete;
+
+        void write(string_view s) {
+            if (buf.size() + s.size() > buffer_size) flush_buffer();
+            if (s.size() > buffer_size) {
+                write_all(s.data(), s.size());
+            } else {
+                buf.append(s.data(), s.size());
+            }
+        }
+
+        void write(char c) {
+            if (buf.size() == buffer_size) flush_buffer();
+            buf.push_back(c);
+        }
+
+        void write_uint(uint64_t x) {
+            char tmp[20];
+            int n = 0;
+            do {
+                tmp[n++] = static_cast<char>('0' + x % 10);
+                x /= 10;
+            } while (x > 0);
+            while (n > 0) write(tmp[--n]);
+        }
+
+        void write_int(int64_t x) {
+            if (x < 0) {
+                write('-');
+                write_uint(static_cast<uint64_t>(-(x + 1)) + 1);
+            } else {
+                write_uint(static_cast<uint64_t>(x));
+            }
+        }
+
+        // Make the file durable under its final name and record its summary, which is returned.
+        OutputSummary commit(uint64_t records) {
+            flush_buffer();
+            if (::fsync(fd) != 0) throw std::runtime_error("fsync failed for " + tmp_name);
+            ::close(fd);
+            fd = -1;
+            ::unlink(output_sidecar_path(filename).c_str());
+            rename_into_place(tmp_name, filename);
+            string sum_tmp = output_sidecar_path(filename) + ".tmp." + std::to_string(::getpid());
+            {
+                ofstream sum(sum_tmp);
+                sum << "records " << records << "\nbytes " << bytes << "\nfnv1a64 " << checksum_hex(hash) << "\n";
+                if (!sum) throw std::runtime_error("Failed to write " + sum_tmp);
+            }
+            int sfd = ::open(sum_tmp.c_str(), O_RDONLY);
+            if (sfd >= 0) {
+                ::fsync(sfd);
+                ::close(sfd);
+            }
+            rename_into_place(sum_tmp, output_sidecar_path(filename));
+            return {records, bytes, checksum_hex(hash)};
+        }
+
+    private:
+        static constexpr size_t buffer_size = 1 << 20;
+
+        string filename;
+        string tmp_name;
+        int fd = -1;
+        string buf;
+        uint64_t bytes = 0;
+        uint64_t hash = fnv1a64(nullptr, 0);
+
+        void flush_buffer() {
+            write_all(buf.data(), buf.size());
+            buf.clear();
+        }
+
+        void write_all(const char* p, size_t n) {
+            hash = fnv1a64(p, n, hash);
+            bytes += n;
+            while (n > 0) {
+                ssize_t w = ::write(fd, p, n);
+                if (w < 0) throw std::runtime_error("Failed to write " + tmp_name + ": " + std::strerror(errno));
+                p += w;
+                n -= w;
+            }
+        }
+
+        static void rename_into_place(const string& from, const string& to) {
+            if (std::rename(from.c_str(), to.c_str()) != 0) {
+                throw std::runtime_error("Failed to rename " + from + " to " + to);
+            }
+            // persist the directory entry
+            size_t pos = to.find_last_of('/');
+            string dir = pos == string::npos ? "." : to.substr(0, pos);
+            int dfd = ::open(dir.c_str(), O_RDONLY);
+            if (dfd >= 0) {
+                ::fsync(dfd);
+                ::close(dfd);
+            }
+        }
+};
+
+// Background thread for output files: write jobs are formatted and written in submission order
+// while the computation goes on. Readers of a file call wait(filename) first, which blocks
+// until no job for it is pending. An error in a job is rethrown by the next wait or flush.
+class AsyncWriter {
+    public:
+        AsyncWriter() : worker([this]() { run(); }) {}
+
+        ~AsyncWriter() {
+            try {
+                flush();
+            } catch (const std::exception& e) {
+                std::cerr << "Error in background writer: " << e.what() << std::endl;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            cv.notify_all();
+            worker.join();
+        }
+
+        AsyncWriter(const AsyncWriter&) = delete;
+        AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+        // Run job(out) on the writer thread with an OutputFile for filename, and commit it with
+        // the number of records job returns; then on_commit, if given, gets the summary of the
+        // file. job should own the data it writes.
+        void submit(const string& filename, std::function<uint64_t(OutputFile&)> job,
+                    std::function<void(const OutputSummary&)> on_commit = nullptr) {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                pending.insert(filename);
+                queue.push_back({filename, std::move(job), std::move(on_commit)});
+            }
+            cv.notify_all();
+        }
+
+        void wait(const string& filename) {
+            std::unique_lock<std::mutex> lock(mtx);
+            done_cv.wait(lock, [&]() { return pending.count(filename) == 0; });
+            rethrow_error();
+        }
+
+        void flush() {
+            std::unique_lock<std::mutex> lock(mtx);
+            done_cv.wait(lock, [&]() { return pending.empty(); });
+            rethrow_error();
+        }
+
+    private:
+        std::mutex mtx;
+        std::condition_variable cv;
+        std::condition_variable done_cv;
+        struct Job {
+            string filename;
+            std::function<uint64_t(OutputFile&)> write;
+            std::function<void(const OutputSummary&)> on_commit;
+        };
+
+        std::deque<Job> queue;
+        std::multiset<string> pending;
+        std::exception_ptr error;
+        bool stop = false;
+        std::thread worker;
+
+        void rethrow_error() {
+            if (error) std::rethrow_exception(std::exchange(error, nullptr));
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true) {
+                cv.wait(lock, [&]() { return stop || !queue.empty(); });
+                if (queue.empty()) return;
+                Job job = std::move(queue.front());
+                queue.pop_front();
+                lock.unlock();
+                try {
+                    INSTR_SCOPE(IO);
+                    OutputFile out(job.filename);
+                    OutputSummary summary = out.commit(job.write(out));
+                    if (job.on_commit) job.on_commit(summary);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(mtx);
+                    if (!error) error = std::current_exception();
+                }
+                job.write = nullptr;
+                lock.lock();
+                pending.erase(pending.find(job.filename));
+                done_cv.notify_all();
+            }
+        }
+};
+
+inline AsyncWriter& async_writer() {
+    static AsyncWriter writer;
+    return writer;
+}
+
+// Whether filename was written completely by an OutputFile: its sidecar exists and records its
+// current size. Waits for a pending background write of it first.
+inline bool output_complete(const string& filename) {
+    async_writer().wait(filename);
+    OutputSummary s;
+    if (!load_output_summary(filename, s)) return false;
+    struct stat st;
+    return ::stat(filename.c_str(), &st) == 0 && static_cast<uint64_t>(st.st_size) == s.bytes;
+}
+
+// Full check of filename against the checksum in its sidecar.
+inline bool verify_output(const string& filename) {
+    OutputSummary s;
+    return output_complete(filename) && load_output_summary(filename, s) && file_checksum(filename) == s.checksum;
+}
+
+#endif // OUTPUTFILE_HH
@@ -0,0 +1,185 @@
+#ifndef SMALLVEC_HH
+#define SMALLVEC_HH
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+using namespace std;
+
+// Vector of trivially copyable elements that stores up to N of them inline and only moves to the
+// heap beyond that. Copies of small vectors are a memcpy of the inline buffer, without malloc.
+// Supports the subset of the std::vector interface used for the edge lists of graphs.
+template <typename T, size_t N>
+class SmallVec {
+    static_assert(std::is_trivially_copyable<T>::value, "SmallVec copies its elements with memcpy");
+
+    public:
+        typedef T value_type;
+        typedef T* iterator;
+        typedef const T* const_iterator;
+        typedef size_t size_type;
+
+        SmallVec() = default;
+
+        SmallVec(std::initializer_list<T> init) {
+            append(init.begin(), init.size());
+        }
+
+        template <typename It, typename = typename std::iterator_traits<It>::iterator_category>
+        SmallVec(It first, It last) {
+            for (; first != last; ++first) push_back(*first);
+        }
+
+        SmallVec(const SmallVec& other) {
+            append(other.data(), other.size_);
+        }
+
+        SmallVec(SmallVec&& other) noexcept {
+            take(other);
+        }
+
+        SmallVec& operator=(const SmallVec& other) {
+            if (this != &other) {
+                size_ = 0;
+                append(other.data(), other.size_);
+            }
+            return *this;
+        }
+
+        SmallVec& operator=(SmallVec&& other) noexcept {
+            if (this != &other) {
+                std::free(heap_);
+                heap_ = nullptr;
+                capacity_ = N;
+                take(other);
+            }
+            return *this;
+        }
+
+        ~SmallVec() {
+            std::free(heap_);
+        }
+
+        T* data() { return heap_ ? heap_ : inline_data(); }
+        const T* data() const { return heap_ ? heap_ : inline_data(); }
+        size_t size() const { return size_; }
+        size_t capacity() const { return capacity_; }
+        bool empty() const { return size_ == 0; }
+
+        iterator begin() { return data(); }
+        iterator end() { return data() + size_; }
+        const_iterator begin() const { return data(); }
+        const_iterator end() const { return data() + size_; }
+
+        T& operator[](size_t i) { return data()[i]; }
+        const T& operator[](size_t i) const { return data()[i]; }
+        T& front() { return data()[0]; }
+        const T& front() const { return data()[0]; }
+        T& back() { return data()[size_ - 1]; }
+        const T& back() const { return data()[size_ - 1]; }
+
+        void reserve(size_t n) {
+            if (n <= capacity_) return;
+            T* p = static_cast<T*>(std::malloc(n * sizeof(T)));
+            if (p == nullptr) throw std::bad_alloc();
+            std::memcpy(static_cast<void*>(p), data(), size_ * sizeof(T));
+            std::free(heap_);
+            heap_ = p;
+            capacity_ = n;
+        }
+
+        // x may be an element of this vector: it is copied before the old buffer is freed.
+        void push_back(const T& x) {
+            if (size_ == capacity_) {
+                T copy = x;
+                reserve(2 * capacity_);
+                data()[size_++] = copy;
+                return;
+            }
+            data()[size_++] = x;
+        }
+
+        template <typename... Args>
+        T& emplace_back(Args&&... args) {
+            // constructed before growing, as the arguments may refer to elements
+            T value(std::forward<Args>(args)...);
+            if (size_ == capacity_) reserve(2 * capacity_);
+            T* slot = data() + size_++;
+            *slot = value;
+            return *slot;
+        }
+
+        void pop_back() { --size_; }
+
+        void clear() { size_ = 0; }
+
+        // Shrinking only; T need not be default constructible.
+        void resize(size_t n) {
+            if (n > size_) throw std::length_error("SmallVec::resize can only shrink");
+            size_ = n;
+        }
+
+        iterator erase(const_iterator first, const_iterator last) {
+            T* f = const_cast<T*>(first);
+            size_t tail = end() - last;
+            std::memmove(static_cast<void*>(f), last, tail * sizeof(T));
+            size_ -= last - first;
+            return f;
+        }
+
+        iterator erase(const_iterator pos) {
+            return erase(pos, pos + 1);
+        }
+
+        bool operator==(const SmallVec& other) const {
+            return size_ == other.size_ && std::equal(begin(), end(), other.begin());
+        }
+
+        bool operator!=(const SmallVec& other) const {
+            return !(*this == other);
+        }
+
+        bool operator<(const SmallVec& other) const {
+            return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+        }
+
+    private:
+        uint32_t size_ = 0;
+        uint32_t capacity_ = N;
+        T* heap_ = nullptr;
+        alignas(T) unsigned char buf_[N * sizeof(T)];
+
+        T* inline_data() { return reinterpret_cast<T*>(buf_); }
+        const T* inline_data() const { return reinterpret_cast<const T*>(buf_); }
+
+        void append(const T* src, size_t n) {
+            reserve(size_ + n);
+            std::memcpy(static_cast<void*>(data() + size_), src, n * sizeof(T));
+            size_ += n;
+        }
+
+        // Move the contents of other (which is left empty) into this empty vector.
+        void take(SmallVec& other) {
+            if (other.heap_) {
+                heap_ = other.heap_;
+                capacity_ = other.capacity_;
+                size_ = other.size_;
+                other.heap_ = nullptr;
+                other.capacity_ = N;
+            } else {
+                size_ = 0;
+                append(other.inline_data(), other.size_);
+            }
+            other.size_ = 0;
+        }
+};
+
+#endif // SMALLVEC_HH
@@ -0,0 +1,162 @@
+#ifndef SPARSEMATRIX_HH
+#define SPARSEMATRIX_HH
+
+#include "OutputFile.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+struct MatrixEntry {
+    size_t row;
+    size_t col;
+    int val;
+};
+
+// Sparse matrix in compressed sparse row format, columns sorted within each row.
+class CsrMatrix {
+    public:
+        size_t nrows = 0;
+        size_t ncols = 0;
+        vector<size_t> row_ptr; // size nrows + 1
+        vector<size_t> col_idx;
+        vector<int> vals;
+
+        CsrMatrix() : row_ptr(1, 0) {}
+
+        CsrMatrix(size_t nrows_, size_t ncols_) : nrows(nrows_), ncols(ncols_), row_ptr(nrows_ + 1, 0) {}
+
+        size_t nnz() const {
+            return col_idx.size();
+        }
+
+        // Build from (row, col, value) entries in any order. Entries at the same position are
+        // summed and zero entries are dropped.
+        static CsrMatrix from_entries(size_t nrows, size_t ncols, vector<MatrixEntry> entries) {
+            std::sort(entries.begin(), entries.end(), [](const MatrixEntry& a, const MatrixEntry& b) {
+                return a.row < b.row || (a.row == b.row && a.col < b.col);
+            });
+            CsrMatrix m(nrows, ncols);
+            m.col_idx.reserve(entries.size());
+            m.vals.reserve(entries.size());
+            size_t i = 0;
+            while (i < entries.size()) {
+                const auto& e = entries[i];
+                if (e.row >= nrows || e.col >= ncols) {
+                    throw std::out_of_range("Matrix entry out of range");
+                }
+                int sum = 0;
+                size_t j = i;
+                for (; j < entries.size() && entries[j].row == e.row && entries[j].col == e.col; ++j) {
+                    sum += entries[j].val;
+                }
+                if (sum != 0) {
+                    m.col_idx.push_back(e.col);
+                    m.vals.push_back(sum);
+                    m.row_ptr[e.row + 1]++;
+                }
+                i = j;
+            }
+            for (size_t r = 0; r < nrows; ++r) m.row_ptr[r + 1] += m.row_ptr[r];
+            return m;
+        }
+
+        static CsrMatrix from_map(const map<pair<size_t, size_t>, int>& matrix, size_t nrows, size_t ncols) {
+            vector<MatrixEntry> entries;
+            entries.reserve(matrix.size());
+            for (const auto& [key, value] : matrix) {
+                entries.push_back({key.first, key.second, value});
+            }
+            return from_entries(nrows, ncols, std::move(entries));
+        }
+
+        // Load a matrix in SMS format (1-based indices, terminated by "0 0 0").
+        static CsrMatrix load_sms(const string& filename) {
+            async_writer().wait(filename);
+            ifstream file(filename);
+            if (!file) throw std::runtime_error("Failed to open file for reading: " + filename);
+            size_t nrows, ncols;
+            string dummy;
+            file >> nrows >> ncols >> dummy;
+            vector<MatrixEntry> entries;
+            while (true) {
+                size_t row, col;
+                int val;
+                if (!(file >> row >> col >> val)) {
+                    throw std::runtime_error("Truncated SMS file: " + filename);
+                }
+                if (row == 0 && col == 0 && val == 0) break;
+                entries.push_back({row - 1, col - 1, val});
+            }
+            return from_entries(nrows, ncols, std::move(entries));
+        }
+
+        // Save in SMS format, entries ordered by row and column.
+        void save_sms(const string& filename) const {
+            OutputFile out(filename);
+            out.commit(write_sms(out));
+        }
+
+        // Write the SMS format to out; returns the number of entries.
+        uint64_t write_sms(OutputFile& out) const {
+            out.write_uint(nrows);
+            out.write(' ');
+            out.write_uint(ncols);
+            out.write(' ');
+            out.write_uint(nnz());
+            out.write('\n');
+            for (size_t r = 0; r < nrows; ++r) {
+                for (size_t i = row_ptr[r]; i < row_ptr[r + 1]; ++i) {
+                    out.write_uint(r + 1);
+                    out.write(' ');
+                    out.write_uint(col_idx[i] + 1);
+                    out.write(' ');
+                    out.write_int(vals[i]);
+                    out.write('\n');
+                }
+            }
+            out.write("0 0 0\n");
+            return nnz();
+        }
+};
+
+// Entry-wise comparison of two matrices of equal shape by merging their sorted rows.
+// Returns the number of differing positions; the first max_report of them are stored in diffs
+// as (row, col, value in a, value in b), with 0 standing for a missing entry.
+inline size_t csr_compare(const CsrMatrix& a, const CsrMatrix& b,
+                          vector<pair<pair<size_t, size_t>, pair<int, int>>>& diffs, size_t max_report = 20) {
+    if (a.nrows != b.nrows || a.ncols != b.ncols) {
+        throw std::invalid_argument("csr_compare: matrix dimensions differ");
+    }
+    size_t num_diffs = 0;
+    auto report = [&](size_t row, size_t col, int va, int vb) {
+        if (num_diffs++ < max_report) diffs.push_back({{row, col}, {va, vb}});
+    };
+    for (size_t r = 0; r < a.nrows; ++r) {
+        size_t i = a.row_ptr[r], iend = a.row_ptr[r + 1];
+        size_t j = b.row_ptr[r], jend = b.row_ptr[r + 1];
+        while (i < iend || j < jend) {
+            if (j == jend || (i < iend && a.col_idx[i] < b.col_idx[j])) {
+                report(r, a.col_idx[i], a.vals[i], 0);
+                ++i;
+            } else if (i == iend || b.col_idx[j] < a.col_idx[i]) {
+                report(r, b.col_idx[j], 0, b.vals[j]);
+                ++j;
+            } else {
+                if (a.vals[i] != b.vals[j]) report(r, a.col_idx[i], a.vals[i], b.vals[j]);
+                ++i;
+                ++j;
+            }
+        }
+    }
+    return num_diffs;
+}
+
+#endif // SPARSEMATRIX_HH
@@ -0,0 +1,120 @@
+#ifndef VALIDATE_HH
+#define VALIDATE_HH
+
+#include "G6File.hh"
+#include "mygraphs.hh"
+#include "parallel.hh"
+#include "progress.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+struct ValidationIssue {
+    size_t line;            // 1-based line number in the file
+    string message;
+
+    bool operator<(const ValidationIssue& other) const {
+        return line < other.line;
+    }
+};
+
+// Bulk check of a basis file, i.e. the number of graphs on the first line followed by one g6
+// code per line. Every graph must pass Graph::validity_error (simple, connected, at least
+// 3-valent and, if defect >= 0, of that defect) and be in canonical form for the selected
+// backend, and the codes must be strictly increasing, i.e. sorted and unique. The graphs are
+// checked in parallel. Prints the first max_reported violations to stderr and returns the
+// number of violations. If the file has an OutputFile sidecar, its checksum and record count
+// are checked too. Front-coded files are numbered as if they were text files, i.e. record i
+// is on line i + 2.
+inline size_t validate_basis_file(const string& fname, int defect, size_t max_reported) {
+    vector<pair<size_t, string>> lines;     // (line number, g6)
+    vector<ValidationIssue> issues;
+    if (is_front_coded_file(fname)) {
+        G6File file(fname);
+        lines.reserve(file.size());
+        for (size_t i = 0; i < file.size(); ++i) lines.emplace_back(i + 2, string(file[i]));
+    } else {
+        INSTR_SCOPE(IO);
+        std::ifstream file(fname);
+        if (!file) throw std::runtime_error("Failed to open file for reading: " + fname);
+        string line;
+        if (!std::getline(file, line)) {
+            issues.push_back({1, "missing header line"});
+        }
+        size_t header = 0;
+        try {
+            size_t pos;
+            header = std::stoul(line, &pos);
+            if (pos != line.size()) throw std::invalid_argument(line);
+        } catch (const std::exception&) {
+            if (issues.empty()) issues.push_back({1, "header is not a number of graphs: '" + line + "'"});
+        }
+        for (size_t no = 2; std::getline(file, line); ++no) {
+            if (!line.empty()) lines.emplace_back(no, std::move(line));
+        }
+        if (issues.empty() && header != lines.size()) {
+            issues.push_back({1, "header says " + std::to_string(header) + " graphs, file has " +
+                                     std::to_string(lines.size())});
+        }
+    }
+
+    OutputSummary summary;
+    if (load_output_summary(fname, summary)) {
+        if (!verify_output(fname)) {
+            issues.push_back({1, "contents do not match the checksum in " + output_sidecar_path(fname)});
+        } else if (summary.records != lines.size()) {
+            issues.push_back({1, output_sidecar_path(fname) + " records " + std::to_string(summary.records) + " graphs"});
+        }
+    } else {
+        std::cerr << fname << ": no " << output_sidecar_path(fname) << ", completeness not recorded\n";
+    }
+
+    vector<vector<ValidationIssue>> found(parallel_num_threads());
+    ProgressReporter progress("validate", lines.size());
+    parallel_for(lines.size(), [&](size_t i, unsigned tid) {
+        ArenaScope scope;
+        auto& local = found[tid];
+        const auto& [no, g6] = lines[i];
+        if (i > 0 && !(lines[i - 1].second < g6)) {
+            local.push_back({no, lines[i - 1].second == g6 ? "duplicate of line " + std::to_string(lines[i - 1].first)
+                                                           : "not sorted after line " + std::to_string(lines[i - 1].first)});
+        }
+        try {
+            Graph G = Graph::from_g6(g6);
+            string err = G.validity_error(defect);
+            if (!err.empty()) {
+                local.push_back({no, "graph " + err});
+            } else {
+                string canon = G.to_canon_g6();
+                if (canon != g6) local.push_back({no, "not in canonical form, expected " + canon});
+            }
+        } catch (const std::exception& e) {
+            local.push_back({no, string("invalid g6 code: ") + e.what()});
+        }
+        progress.inc();
+    });
+    progress.finish();
+
+    for (auto& local : found) {
+        issues.insert(issues.end(), std::make_move_iterator(local.begin()), std::make_move_iterator(local.end()));
+    }
+    std::stable_sort(issues.begin(), issues.end());
+    for (size_t k = 0; k < issues.size() && k < max_reported; ++k) {
+        const auto& issue = issues[k];
+        std::cerr << fname << ":" << issue.line << ": " << issue.message << "\n";
+    }
+    if (issues.size() > max_reported) {
+        std::cerr << "... and " << issues.size() - max_reported << " more\n";
+    }
+    std::cout << fname << ": " << lines.size() << " graphs, " << issues.size() << " problems" << std::endl;
+    return issues.size();
+}
+
+#endif // VALIDATE_HH
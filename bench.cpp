@@ -0,0 +1,235 @@
+// Microbenchmarks for the graph kernels used by the Kneissler generator.
+// Every kernel runs on a fixed, seeded sample of graphs from the Kneissler families
+// (8-12 loops by default). Results are written as JSON, one result object per line,
+// so two runs can be compared with a plain diff or a small script. With --compare-canon the
+// canonicalization kernels are repeated for every available backend (make NAUTY=1 for nauty).
+#include "mygraphs.hh"
+#include "Kneissler.hh"
+#include "CLI11.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+using namespace std;
+
+// Keeps the compiler from discarding the results of the benchmarked calls.
+static volatile size_t bench_sink = 0;
+
+struct BenchResult {
+    string kernel;
+    int loops;
+    size_t num_inputs;
+    vector<double> ns_per_op; // one sample per repetition
+};
+
+static double percentile(const vector<double>& sorted, double q) {
+    // nearest-rank percentile of an already sorted sample: the smallest value such that at
+    // least a fraction q of the sample is at most it
+    if (sorted.empty()) return 0.0;
+    size_t rank = static_cast<size_t>(std::ceil(q * sorted.size()));
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+// Run `body(i)` on all inputs i: `warmup` untimed passes, then `reps` timed passes.
+// Each timed pass yields one sample (average nanoseconds per call).
+static BenchResult run_kernel(const string& name, int loops, size_t num_inputs, int warmup, int reps,
+                              const std::function<size_t(size_t)>& body) {
+    BenchResult r{name, loops, num_inputs, {}};
+    for (int w = 0; w < warmup; ++w) {
+        for (size_t i = 0; i < num_inputs; ++i) bench_sink += body(i);
+    }
+    for (int rep = 0; rep < reps; ++rep) {
+        auto t0 = std::chrono::steady_clock::now();
+        size_t acc = 0;
+        for (size_t i = 0; i < num_inputs; ++i) acc += body(i);
+        auto t1 = std::chrono::steady_clock::now();
+        bench_sink += acc;
+        double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+        r.ns_per_op.push_back(ns / num_inputs);
+    }
+    return r;
+}
+
+static string result_to_json(const BenchResult& r) {
+    vector<double> s = r.ns_per_op;
+    std::sort(s.begin(), s.end());
+    double mean = s.empty() ? 0.0 : std::accumulate(s.begin(), s.end(), 0.0) / s.size();
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"kernel\": \"%s\", \"loops\": %d, \"inputs\": %zu, \"reps\": %zu, "
+             "\"min_ns\": %.1f, \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"mean_ns\": %.1f}",
+             r.kernel.c_str(), r.loops, r.num_inputs, s.size(),
+             s.empty() ? 0.0 : s.front(), percentile(s, 0.5), percentile(s, 0.9), percentile(s, 0.99), mean);
+    return buf;
+}
+
+// A random permutation of {0,...,n-1}, drawn from a seeded generator.
+static vector<uint8_t> random_permutation(uint8_t n, std::mt19937_64& rng) {
+    vector<uint8_t> p(n);
+    std::iota(p.begin(), p.end(), 0);
+    std::shuffle(p.begin(), p.end(), rng);
+    return p;
+}
+
+int main(int argc, char** argv) {
+    CLI::App app{"Microbenchmarks for the graph kernels"};
+
+    int min_loops = 8;
+    int max_loops = 12;
+    int num_inputs = 64;
+    int warmup = 3;
+    int reps = 30;
+    uint64_t seed = 12345;
+    string filter;
+    string out_file;
+    bool compare_canon = false;
+
+    app.add_option("--min-loops", min_loops, "Smallest loop order (default 8)");
+    app.add_option("--max-loops", max_loops, "Largest loop order (default 12)");
+    app.add_option("-n,--inputs", num_inputs, "Number of sampled graphs per family (default 64)");
+    app.add_option("-w,--warmup", warmup, "Untimed warmup passes (default 3)");
+    app.add_option("-r,--reps", reps, "Timed repetitions (default 30)");
+    app.add_option("-s,--seed", seed, "Seed for the input sample (default 12345)");
+    app.add_option("-f,--filter", filter, "Only run kernels whose name contains this string");
+    app.add_option("-o,--output", out_file, "Write the JSON results to this file instead of stdout");
+    app.add_flag("--compare-canon", compare_canon,
+                 "Also run the canonicalization kernels with every available backend (canon_<backend>_*)");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (min_loops < 3 || max_loops < min_loops || num_inputs <= 0 || reps <= 0) {
+        std::cerr << "Invalid benchmark parameters" << std::endl;
+        return 1;
+    }
+
+    vector<BenchResult> results;
+    auto want = [&](const string& name) { return filter.empty() || name.find(filter) != string::npos; };
+
+    for (int loops = min_loops; loops <= max_loops; ++loops) {
+        uint8_t k = loops - 1;
+        std::mt19937_64 rng(seed + loops);
+
+        // fixed, seeded inputs from the Kneissler families
+        vector<vector<uint8_t>> perms;
+        vector<Graph> barrels;
+        vector<Graph> tbarrels;
+        for (int i = 0; i < num_inputs; ++i) {
+            perms.push_back(random_permutation(k - 1, rng));
+            barrels.push_back(barrel_graph(k, perms.back()));
+            tbarrels.push_back(tbarrel_graph(k, perms.back()));
+        }
+        vector<string> g6s;
+        for (const auto& g : barrels) g6s.push_back(g.to_g6());
+        vector<ScratchPermutation> vperms;
+        for (int i = 0; i < num_inputs; ++i) {
+            vector<uint8_t> p = random_permutation(2 * k, rng);
+            vperms.emplace_back(p.begin(), p.end());
+        }
+
+        size_t n = num_inputs;
+        const GraphKernels& fixed = kneissler_kernels(loops, false);
+        std::cerr << "Loop order " << loops << " (" << 2 * (int)k << " vertices)" << std::endl;
+
+        if (want("barrel_graph"))
+            results.push_back(run_kernel("barrel_graph", loops, n, warmup, reps, [&](size_t i) {
+                return barrel_graph(k, perms[i]).edges.size();
+            }));
+        if (want("to_g6"))
+            results.push_back(run_kernel("to_g6", loops, n, warmup, reps, [&](size_t i) {
+                return barrels[i].to_g6().size();
+            }));
+        if (want("fixed_to_g6"))
+            results.push_back(run_kernel("fixed_to_g6", loops, n, warmup, reps, [&](size_t i) {
+                return fixed.to_g6(barrels[i]).size();
+            }));
+        if (want("from_g6"))
+            results.push_back(run_kernel("from_g6", loops, n, warmup, reps, [&](size_t i) {
+                return Graph::from_g6(g6s[i]).edges.size();
+            }));
+        if (want("to_canon_g6"))
+            results.push_back(run_kernel("to_canon_g6", loops, n, warmup, reps, [&](size_t i) {
+                return barrels[i].to_canon_g6().size();
+            }));
+        if (want("to_canon_g6_sgn"))
+            results.push_back(run_kernel("to_canon_g6_sgn", loops, n, warmup, reps, [&](size_t i) {
+                auto [s, sgn] = tbarrels[i].to_canon_g6_sgn(false);
+                return s.size() + sgn;
+            }));
+        for (bool even_edges : {true, false}) {
+            string suffix = even_edges ? "_even" : "_odd";
+            if (want("has_odd_automorphism" + suffix))
+                results.push_back(run_kernel("has_odd_automorphism" + suffix, loops, n, warmup, reps, [&](size_t i) {
+                    return (size_t)barrels[i].has_odd_automorphism(even_edges);
+                }));
+            if (want("perm_sign" + suffix))
+                results.push_back(run_kernel("perm_sign" + suffix, loops, n, warmup, reps, [&](size_t i) {
+                    return (size_t)(barrels[i].perm_sign(vperms[i], even_edges) + 1);
+                }));
+            if (want("get_contractions_with_sign" + suffix))
+                results.push_back(run_kernel("get_contractions_with_sign" + suffix, loops, n, warmup, reps, [&](size_t i) {
+                    return barrels[i].get_contractions_with_sign(even_edges).size();
+                }));
+            if (want("fixed_perm_sign" + suffix))
+                results.push_back(run_kernel("fixed_perm_sign" + suffix, loops, n, warmup, reps, [&](size_t i) {
+                    return (size_t)(fixed.perm_sign(barrels[i], vperms[i], even_edges) + 1);
+                }));
+            if (want("fixed_get_contractions_with_sign" + suffix))
+                results.push_back(run_kernel("fixed_get_contractions_with_sign" + suffix, loops, n, warmup, reps, [&](size_t i) {
+                    return fixed.get_contractions_with_sign(barrels[i], even_edges).size();
+                }));
+        }
+
+        if (compare_canon) {
+            // relabeled copies, to check that every backend canonicalizes consistently
+            vector<Graph> relabeled = barrels;
+            for (auto& g : relabeled) g.relabel(random_permutation(g.num_vertices, rng));
+            for (CanonBackend b : available_canon_backends()) {
+                canon_backend = b;
+                string prefix = string("canon_") + canon_backend_name(b) + "_";
+                for (size_t i = 0; i < n; ++i) {
+                    if (barrels[i].to_canon_g6() != relabeled[i].to_canon_g6()) {
+                        std::cerr << "Inconsistent canonical forms with " << canon_backend_name(b)
+                                  << " for " << barrels[i].to_g6() << std::endl;
+                        return 1;
+                    }
+                }
+                if (want(prefix + "barrel"))
+                    results.push_back(run_kernel(prefix + "barrel", loops, n, warmup, reps, [&](size_t i) {
+                        return barrels[i].to_canon_g6().size();
+                    }));
+                if (want(prefix + "tbarrel"))
+                    results.push_back(run_kernel(prefix + "tbarrel", loops, n, warmup, reps, [&](size_t i) {
+                        return tbarrels[i].to_canon_g6().size();
+                    }));
+                if (want(prefix + "canonical_form_odd"))
+                    results.push_back(run_kernel(prefix + "canonical_form_odd", loops, n, warmup, reps, [&](size_t i) {
+                        CanonicalForm cf = barrels[i].canonical_form(false);
+                        return cf.g6.size() + cf.odd_automorphism;
+                    }));
+            }
+            canon_backend = CanonBackend::Bliss;
+        }
+    }
+
+    std::ostringstream json;
+    json << "{\n\"seed\": " << seed << ", \"warmup\": " << warmup << ", \"reps\": " << reps
+         << ", \"inputs\": " << num_inputs << ",\n\"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        json << result_to_json(results[i]) << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "]\n}\n";
+
+    if (out_file.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream f(out_file);
+        if (!f) throw std::runtime_error("Failed to open file for writing");
+        f << json.str();
+        std::cerr << "Results written to " << out_file << std::endl;
+    }
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "bliss/graph.hh"
+#include "mygraphs.hh"
+#include "parallel.hh"
+#include <algorithm>
+#include <cstdint>
 #include <sstream>
-#include <iostream>
 #include <vector>
 #include <string>
 #include <cstring>
@@ -34,4 +37,113 @@ void canonicalize_graph(
     std::memcpy(out_permutation, perm, n * sizeof(unsigned int));
 }
 
+// Number of 64-bit words of the packed adjacency code of a graph with n vertices: one bit per
+// vertex pair (i, j), i < j, in graph6 order (by j, then i), bit k in word k / 64 at k % 64.
+size_t packed_code_words(unsigned int n) {
+    size_t bits = static_cast<size_t>(n) * (n > 0 ? n - 1 : 0) / 2;
+    return (bits + 63) / 64;
+}
+
+// Canonicalize a batch of graphs on an internal thread pool.
+// Input, graph g in [0, num_graphs):
+//   vertices vertex_offsets[g] .. vertex_offsets[g+1]-1, numbered from 0 within the graph
+//     (at most 255 vertices per graph),
+//   edges edge_offsets[g] .. edge_offsets[g+1]-1 of the flat array `edges` of u32 pairs.
+// Output, all arrays allocated by the caller:
+//   out_permutations[vertex_offsets[g] + v] = canonical label of vertex v,
+//   out_codes[code_offsets[g] ..] = packed adjacency code of the canonical graph, with
+//     code_offsets[g+1] - code_offsets[g] >= packed_code_words(n); may be NULL,
+//   out_odd[g] = 1 if the graph has an automorphism acting by -1 for the edge parity
+//     even_edges, else 0; out_sign[g] = sign of the canonical relabeling. Both may be NULL,
+//     then the parity is not computed.
+// Graphs must be simple, with at most 256 edges (the limit of the edge numbering of the sign rule).
+// num_threads = 0 uses all cores. Returns 0 on success, 1 + the index of the first invalid graph
+// (then nothing is written), or -1 if canonicalization failed (the outputs are then undefined).
+// On failure the reason is written to error_message as a NUL-terminated string truncated to
+// error_size bytes, if error_message is not NULL. No C++ exception leaves this function, and
+// nothing is printed.
+int canonicalize_graph_batch(
+    size_t num_graphs,
+    const size_t* vertex_offsets,
+    const size_t* edge_offsets,
+    const unsigned int* edges,
+    int even_edges,
+    unsigned int num_threads,
+    unsigned int* out_permutations,
+    const size_t* code_offsets,
+    uint64_t* out_codes,
+    int8_t* out_odd,
+    int8_t* out_sign,
+    char* error_message,
+    size_t error_size
+) {
+    auto set_error = [&](const char* what) {
+        if (error_message == nullptr || error_size == 0) return;
+        std::strncpy(error_message, what, error_size - 1);
+        error_message[error_size - 1] = '\0';
+    };
+    for (size_t g = 0; g < num_graphs; ++g) {
+        size_t n = vertex_offsets[g + 1] - vertex_offsets[g];
+        if (vertex_offsets[g + 1] < vertex_offsets[g] || edge_offsets[g + 1] < edge_offsets[g] || n > 255 ||
+            edge_offsets[g + 1] - edge_offsets[g] > 256) {
+            return static_cast<int>(g + 1);
+        }
+        // at most 256 edges, so the pairs (u, v) with u < v fit in a small sorted array; no
+        // allocation, so nothing can throw outside the try block below
+        uint32_t pairs[256];
+        size_t num_pairs = 0;
+        for (size_t e = edge_offsets[g]; e < edge_offsets[g + 1]; ++e) {
+            unsigned int u = edges[2 * e], v = edges[2 * e + 1];
+            if (u >= n || v >= n || u == v) return static_cast<int>(g + 1);
+            pairs[num_pairs++] = std::min(u, v) << 8 | std::max(u, v);
+        }
+        std::sort(pairs, pairs + num_pairs);
+        if (std::adjacent_find(pairs, pairs + num_pairs) != pairs + num_pairs) return static_cast<int>(g + 1);
+        if (out_codes != nullptr && code_offsets[g + 1] - code_offsets[g] < packed_code_words(n)) {
+            return static_cast<int>(g + 1);
+        }
+    }
+
+    bool want_parity = out_odd != nullptr || out_sign != nullptr;
+    try {
+        parallel_for(num_graphs, [&](size_t g, unsigned) {
+            ArenaScope scope;
+            uint8_t n = static_cast<uint8_t>(vertex_offsets[g + 1] - vertex_offsets[g]);
+            Graph G(n);
+            for (size_t e = edge_offsets[g]; e < edge_offsets[g + 1]; ++e) {
+                G.add_edge(edges[2 * e], edges[2 * e + 1]);
+            }
+            bool odd = false;
+            auto report = [&](unsigned k, const unsigned* perm) {
+                if (!want_parity || odd) return;
+                ScratchPermutation p(perm, perm + k);
+                if (G.perm_sign(p, even_edges != 0) != 1) odd = true;
+            };
+            ScratchPermutation labels;
+            G.search_automorphisms({}, true, report, labels);
+            unsigned int* perm_out = out_permutations + vertex_offsets[g];
+            for (uint8_t v = 0; v < n; ++v) perm_out[v] = labels[v];
+            if (out_odd != nullptr) out_odd[g] = odd ? 1 : 0;
+            if (out_sign != nullptr) out_sign[g] = static_cast<int8_t>(G.perm_sign(labels, even_edges != 0));
+            if (out_codes != nullptr) {
+                uint64_t* code = out_codes + code_offsets[g];
+                std::memset(code, 0, packed_code_words(n) * sizeof(uint64_t));
+                for (const auto& e : G.edges) {
+                    size_t i = labels[e.u], j = labels[e.v];
+                    if (i > j) std::swap(i, j);
+                    size_t k = j * (j - 1) / 2 + i;
+                    code[k / 64] |= uint64_t(1) << (k % 64);
+                }
+            }
+        }, num_threads);
+    } catch (const std::exception& e) {
+        set_error(e.what());
+        return -1;
+    } catch (...) {
+        set_error("unknown exception");
+        return -1;
+    }
+    return 0;
+}
+
 }
@@ -1,11 +1,20 @@
+#include <cstdio>
 #include <iostream>
 #include <vector>
 #include <utility>
 #include <functional>
+#include <string>
+#include <unordered_set>
 #include "bliss/graph.hh"
 #include "mygraphs.hh"
+#include "parallel.hh"
+#include "CLI11.hpp"
 
-int main() {
+// Output is collected in memory and written in large blocks.
+static const size_t output_block_size = 1 << 20;
+
+// Default mode: read "n u1 v1 u2 v2 ..." from stdin and print the automorphism group generators.
+static int print_generators() {
     int n;
     std::cin >> n;
 
@@ -35,3 +44,93 @@ int main() {
 
     return 0;
 }
+
+// Streaming mode, a drop-in for "labelg -g": read graph6 lines from stdin and write their canonical
+// forms, one per line in input order. Batches of lines are canonicalized in parallel while the
+// reading and writing stay sequential. With unique, only the first occurrence of every canonical
+// form is written, so a single process replaces canonicalize-then-deduplicate pipelines.
+static int stream_g6(size_t batch_size, bool unique) {
+    std::ios::sync_with_stdio(false);
+    std::unordered_set<string> seen;
+    std::vector<string> lines;
+    std::vector<string> canon;
+    string out;
+    out.reserve(output_block_size + 4096);
+    size_t line_no = 0;
+    bool eof = false;
+
+    auto flush = [&]() {
+        if (out.empty()) return;
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        out.clear();
+    };
+
+    while (!eof) {
+        lines.clear();
+        string line;
+        while (lines.size() < batch_size) {
+            if (!std::getline(std::cin, line)) {
+                eof = true;
+                break;
+            }
+            ++line_no;
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            // optional header of graph6 files
+            if (line.compare(0, 10, ">>graph6<<") == 0) line.erase(0, 10);
+            if (line.empty()) continue;
+            lines.push_back(std::move(line));
+        }
+        canon.assign(lines.size(), string());
+        try {
+            parallel_for(lines.size(), [&](size_t i, unsigned) {
+                canon[i] = Graph::from_g6(lines[i]).to_canon_g6();
+            });
+        } catch (const std::exception& e) {
+            flush();
+            std::fflush(stdout);
+            std::cerr << "Invalid graph6 input near line " << line_no << ": " << e.what() << std::endl;
+            return 1;
+        }
+        for (auto& g6 : canon) {
+            if (unique && !seen.insert(g6).second) continue;
+            out += g6;
+            out += '\n';
+            if (out.size() >= output_block_size) flush();
+        }
+    }
+    flush();
+    std::fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    CLI::App app{"bliss command line tool: automorphism generators of an edge list (default), "
+                 "or canonical graph6 forms of a graph6 stream (-g)"};
+
+    bool g6_mode = false;
+    bool unique = false;
+    unsigned num_threads = 0;
+    size_t batch_size = 1 << 16;
+    string canon = "bliss";
+
+    app.add_flag("-g,--g6", g6_mode, "Read graph6 lines from stdin and write canonical graph6 lines (like labelg -g)");
+    app.add_flag("-u,--unique", unique, "With -g, write every canonical form only once");
+    app.add_option("-j,--threads", num_threads, "Number of worker threads (default: all cores)");
+    app.add_option("--batch", batch_size, "With -g, number of lines canonicalized per parallel batch")
+        ->check(CLI::PositiveNumber);
+    app.add_option("--canon", canon, "Canonical labeling backend for -g (default bliss)");
+
+    CLI11_PARSE(app, argc, argv);
+    parallel_num_threads_setting = num_threads;
+    try {
+        canon_backend = parse_canon_backend(canon);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    if (g6_mode) {
+        return stream_g6(batch_size, unique);
+    }
+    return print_generators();
+}
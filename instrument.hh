@@ -0,0 +1,333 @@
+#ifndef INSTRUMENT_HH
+#define INSTRUMENT_HH
+
+// Compile-time switchable hot-path instrumentation.
+//
+// Build with -DGGEN_INSTRUMENT (make INSTRUMENT=1) to time the phases below and count events;
+// add -DGGEN_INSTRUMENT_PERF (make INSTRUMENT=perf, Linux only) to also read hardware cycle and
+// instruction counters through perf_event_open. Without GGEN_INSTRUMENT the macros expand to
+// nothing.
+//
+// Usage:
+//     INSTR_SCOPE(BlissSearch);          // times the rest of the enclosing block
+//     INSTR_COUNT(BlissNodes, stats.get_nof_nodes());
+//
+// Times are exclusive: a scope nested in another one (e.g. perm_sign called from a bliss
+// automorphism callback) is subtracted from its parent. Every thread aggregates into its own
+// record, so the hot path takes no locks; the records are summed and printed to stderr as a
+// per-phase table at exit, followed by the counters; the arena counters (see Arena.hh) are also
+// shown per candidate.
+
+enum class InstrPhase {
+    GraphConstruction,
+    BlissSearch,
+    SignComputation,
+    G6Encoding,
+    DedupInsert,
+    MatrixAssembly,
+    IO,
+    NumPhases
+};
+
+enum class InstrCounter {
+    Candidates,
+    BlissCalls,
+    BlissNodes,
+    AutomorphismGenerators,
+    DedupInserts,
+    DedupSpills,
+    MatrixEntries,
+    ArenaScopes,
+    ArenaAllocations,
+    ArenaBytes,
+    NumCounters
+};
+
+#ifdef GGEN_INSTRUMENT
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+#ifdef GGEN_INSTRUMENT_PERF
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+inline const char* instr_phase_name(InstrPhase p) {
+    switch (p) {
+        case InstrPhase::GraphConstruction: return "graph construction";
+        case InstrPhase::BlissSearch: return "canonical search";
+        case InstrPhase::SignComputation: return "sign computation";
+        case InstrPhase::G6Encoding: return "g6 encode/decode";
+        case InstrPhase::DedupInsert: return "dedup insert";
+        case InstrPhase::MatrixAssembly: return "matrix assembly";
+        case InstrPhase::IO: return "file I/O";
+        default: return "?";
+    }
+}
+
+inline const char* instr_counter_name(InstrCounter c) {
+    switch (c) {
+        case InstrCounter::Candidates: return "candidates";
+        case InstrCounter::BlissCalls: return "canonicalizer calls";
+        case InstrCounter::BlissNodes: return "search tree nodes";
+        case InstrCounter::AutomorphismGenerators: return "automorphism generators";
+        case InstrCounter::DedupInserts: return "dedup inserts";
+        case InstrCounter::DedupSpills: return "dedup runs spilled";
+        case InstrCounter::MatrixEntries: return "matrix entries";
+        case InstrCounter::ArenaScopes: return "arena scopes";
+        case InstrCounter::ArenaAllocations: return "arena allocations";
+        case InstrCounter::ArenaBytes: return "arena bytes";
+        default: return "?";
+    }
+}
+
+constexpr size_t instr_num_phases = static_cast<size_t>(InstrPhase::NumPhases);
+constexpr size_t instr_num_counters = static_cast<size_t>(InstrCounter::NumCounters);
+
+struct InstrSample {
+    uint64_t ns = 0;
+    uint64_t cycles = 0;
+    uint64_t instructions = 0;
+};
+
+// Per-thread record. Only the owning thread writes to it.
+struct InstrThreadStats {
+    uint64_t calls[instr_num_phases] = {};
+    InstrSample excl[instr_num_phases] = {};
+    uint64_t counters[instr_num_counters] = {};
+    // total time of the scopes nested in the currently open scope
+    InstrSample child;
+#ifdef GGEN_INSTRUMENT_PERF
+    int perf_fd = -1;           // group leader (cycles)
+    int perf_member_fd = -1;    // instructions
+#endif
+
+    void add(const InstrThreadStats& other) {
+        for (size_t i = 0; i < instr_num_phases; ++i) {
+            calls[i] += other.calls[i];
+            excl[i].ns += other.excl[i].ns;
+            excl[i].cycles += other.excl[i].cycles;
+            excl[i].instructions += other.excl[i].instructions;
+        }
+        for (size_t i = 0; i < instr_num_counters; ++i) {
+            counters[i] += other.counters[i];
+        }
+    }
+};
+
+class InstrRegistry {
+    public:
+        ~InstrRegistry() {
+            print();
+        }
+
+        void register_thread(InstrThreadStats* ts) {
+            std::lock_guard<std::mutex> lock(mtx);
+            live.push_back(ts);
+            ++num_threads;
+        }
+
+        // Merge the record of an exiting thread into the total of the finished threads.
+        void retire_thread(InstrThreadStats* ts) {
+            std::lock_guard<std::mutex> lock(mtx);
+            retired.add(*ts);
+            live.erase(std::find(live.begin(), live.end(), ts));
+        }
+
+        void print() {
+            std::lock_guard<std::mutex> lock(mtx);
+            double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            InstrThreadStats sum;
+            sum.add(retired);
+            for (auto* ts : live) sum.add(*ts);
+            const uint64_t* calls = sum.calls;
+            const InstrSample* tot = sum.excl;
+            const uint64_t* counters = sum.counters;
+            uint64_t sum_ns = 0;
+            for (size_t i = 0; i < instr_num_phases; ++i) sum_ns += tot[i].ns;
+
+            fprintf(stderr, "\n=== Instrumentation (%zu threads, wall %.3f s) ===\n", num_threads, wall);
+            fprintf(stderr, "%-20s %14s %12s %7s %12s", "phase", "calls", "time [s]", "%", "ns/call");
+#ifdef GGEN_INSTRUMENT_PERF
+            fprintf(stderr, " %16s %16s %6s", "cycles", "instructions", "IPC");
+#endif
+            fprintf(stderr, "\n");
+            for (size_t i = 0; i < instr_num_phases; ++i) {
+                if (calls[i] == 0) continue;
+                fprintf(stderr, "%-20s %14llu %12.3f %6.1f%% %12.1f",
+                        instr_phase_name(static_cast<InstrPhase>(i)), (unsigned long long)calls[i],
+                        tot[i].ns * 1e-9, sum_ns ? 100.0 * tot[i].ns / sum_ns : 0.0,
+                        static_cast<double>(tot[i].ns) / calls[i]);
+#ifdef GGEN_INSTRUMENT_PERF
+                fprintf(stderr, " %16llu %16llu %6.2f", (unsigned long long)tot[i].cycles,
+                        (unsigned long long)tot[i].instructions,
+                        tot[i].cycles ? static_cast<double>(tot[i].instructions) / tot[i].cycles : 0.0);
+#endif
+                fprintf(stderr, "\n");
+            }
+            fprintf(stderr, "%-20s %14s %12.3f (summed over threads)\n", "total instrumented", "", sum_ns * 1e-9);
+#ifdef GGEN_INSTRUMENT_PERF
+            uint64_t sum_cycles = 0;
+            for (size_t i = 0; i < instr_num_phases; ++i) sum_cycles += tot[i].cycles;
+            if (sum_cycles == 0) fprintf(stderr, "(perf_event_open unavailable, hardware counters not read)\n");
+#endif
+            for (size_t i = 0; i < instr_num_counters; ++i) {
+                if (counters[i] == 0) continue;
+                fprintf(stderr, "%-24s %llu\n", instr_counter_name(static_cast<InstrCounter>(i)),
+                        (unsigned long long)counters[i]);
+            }
+            uint64_t scopes = counters[static_cast<size_t>(InstrCounter::ArenaScopes)];
+            if (scopes > 0) {
+                fprintf(stderr, "%-24s %.1f allocations, %.1f bytes\n", "arena per candidate",
+                        static_cast<double>(counters[static_cast<size_t>(InstrCounter::ArenaAllocations)]) / scopes,
+                        static_cast<double>(counters[static_cast<size_t>(InstrCounter::ArenaBytes)]) / scopes);
+            }
+        }
+
+    private:
+        std::mutex mtx;
+        // records of the running threads, and the sum over the threads that have exited
+        std::vector<InstrThreadStats*> live;
+        InstrThreadStats retired;
+        size_t num_threads = 0;
+        std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+};
+
+inline InstrRegistry instr_registry;
+
+#ifdef GGEN_INSTRUMENT_PERF
+// Open a cycles+instructions counter group for the calling thread into ts; the fds stay -1 if
+// perf is unavailable.
+inline void instr_open_perf_group(InstrThreadStats& ts) {
+    auto open_counter = [](uint64_t config, int group_fd) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.disabled = (group_fd == -1);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+    };
+    int leader = open_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+    if (leader < 0) return;
+    int member = open_counter(PERF_COUNT_HW_INSTRUCTIONS, leader);
+    if (member < 0) {
+        close(leader);
+        return;
+    }
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    ts.perf_fd = leader;
+    ts.perf_member_fd = member;
+}
+#endif
+
+// Owner of the record of a thread. When the thread exits, e.g. a parallel_for pool worker at
+// program exit, its counters are merged into the registry and its perf counters are closed.
+class InstrThreadHolder {
+    public:
+        InstrThreadHolder() {
+#ifdef GGEN_INSTRUMENT_PERF
+            instr_open_perf_group(stats);
+#endif
+            instr_registry.register_thread(&stats);
+        }
+
+        ~InstrThreadHolder() {
+            instr_registry.retire_thread(&stats);
+#ifdef GGEN_INSTRUMENT_PERF
+            if (stats.perf_member_fd >= 0) close(stats.perf_member_fd);
+            if (stats.perf_fd >= 0) close(stats.perf_fd);
+#endif
+        }
+
+        InstrThreadHolder(const InstrThreadHolder&) = delete;
+        InstrThreadHolder& operator=(const InstrThreadHolder&) = delete;
+
+        InstrThreadStats stats;
+};
+
+inline InstrThreadStats& instr_thread_stats() {
+    thread_local InstrThreadHolder holder;
+    return holder.stats;
+}
+
+inline InstrSample instr_now(InstrThreadStats& ts) {
+    InstrSample s;
+    s.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+#ifdef GGEN_INSTRUMENT_PERF
+    if (ts.perf_fd >= 0) {
+        uint64_t buf[3];
+        if (read(ts.perf_fd, buf, sizeof(buf)) == sizeof(buf)) {
+            s.cycles = buf[1];
+            s.instructions = buf[2];
+        }
+    }
+#else
+    (void)ts;
+#endif
+    return s;
+}
+
+class InstrScope {
+    public:
+        explicit InstrScope(InstrPhase p) : ts(instr_thread_stats()), phase(static_cast<size_t>(p)) {
+            saved_child = ts.child;
+            ts.child = InstrSample();
+            start = instr_now(ts);
+        }
+
+        ~InstrScope() {
+            InstrSample end = instr_now(ts);
+            InstrSample elapsed;
+            elapsed.ns = end.ns - start.ns;
+            elapsed.cycles = end.cycles - start.cycles;
+            elapsed.instructions = end.instructions - start.instructions;
+            ts.calls[phase]++;
+            ts.excl[phase].ns += elapsed.ns - ts.child.ns;
+            ts.excl[phase].cycles += elapsed.cycles - ts.child.cycles;
+            ts.excl[phase].instructions += elapsed.instructions - ts.child.instructions;
+            ts.child.ns = saved_child.ns + elapsed.ns;
+            ts.child.cycles = saved_child.cycles + elapsed.cycles;
+            ts.child.instructions = saved_child.instructions + elapsed.instructions;
+        }
+
+        InstrScope(const InstrScope&) = delete;
+        InstrScope& operator=(const InstrScope&) = delete;
+
+    private:
+        InstrThreadStats& ts;
+        size_t phase;
+        InstrSample start;
+        InstrSample saved_child;
+};
+
+inline void instr_count(InstrCounter c, uint64_t n) {
+    instr_thread_stats().counters[static_cast<size_t>(c)] += n;
+}
+
+#define INSTR_CONCAT_(a, b) a##b
+#define INSTR_CONCAT(a, b) INSTR_CONCAT_(a, b)
+#define INSTR_SCOPE(phase) InstrScope INSTR_CONCAT(instr_scope_, __LINE__)(InstrPhase::phase)
+#define INSTR_COUNT(counter, n) instr_count(InstrCounter::counter, (n))
+
+#else
+
+#define INSTR_SCOPE(phase) do {} while (0)
+#define INSTR_COUNT(counter, n) do {} while (0)
+
+#endif // GGEN_INSTRUMENT
+
+#endif // INSTRUMENT_HH
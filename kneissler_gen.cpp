@@ -1,6 +1,10 @@
 #include "mygraphs.hh"
 #include "Kneissler.hh"
+#include "OrdinaryGC.hh"
+#include "Validate.hh"
+#include "progress.hh"
 #include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include "CLI11.hpp"
 
@@ -43,16 +47,156 @@ int main(int argc, char** argv) {
     bool compute_bases = false;
     bool even_edges = false;
     bool overwrite = false;
+    bool no_progress = false;
+    bool verify = false;
+    bool orderly = false;
+    bool generic_kernels = false;
+    bool compress = false;
+    bool compute_rank = false;
+    bool sched_stats = false;
+    size_t num_primes = 1;
+    unsigned num_threads = 0;
+    size_t mem_budget = 0;
+    string canon = "bliss";
 
-    app.add_option("range_loops", r_loops, "Range in format start:end")->required();
-    app.add_option("range_types", r_types, "Range in format start:end")->required();
+    app.add_option("range_loops", r_loops, "Range in format start:end");
+    app.add_option("range_types", r_types, "Range in format start:end");
     app.add_flag("-m,--compute-matrices", compute_matrices, "Compute matrices");
     app.add_flag("-b,--compute-bases", compute_bases, "Compute bases");
     app.add_flag("-e,--even-edges", even_edges, "Use even edges");
     app.add_flag("-o,--overwrite", overwrite, "Overwrite existing files");
+    app.add_flag("--no-progress", no_progress, "Do not print progress and ETA");
+    app.add_flag("--verify", verify, "Compare bases (and matrices with -m) to the reference files");
+    app.add_flag("--orderly", orderly,
+                  "Generate the lists of all ordinary graphs by canonical augmentation, without a dedup set");
+    app.add_flag("--generic-kernels", generic_kernels,
+                  "Use the generic graph kernels instead of the ones specialized for loop orders 3-16");
+    app.add_flag("--compress", compress,
+                  "Write basis files front-coded; readers detect the format, so files of both formats can be mixed");
+    app.add_flag("--rank", compute_rank, "With -m, also compute the ranks of the matrices modulo 32-bit primes");
+    app.add_option("--primes", num_primes, "Number of primes for --rank (default 1, at most 8)")
+        ->check(CLI::Range(1, 8));
+    app.add_option("--canon", canon,
+                   "Canonical labeling backend: bliss, nauty, sparsenauty or traces (default bliss). "
+                   "Bases and matrices that are used together must be built with the same backend");
+    app.add_option("-j,--threads", num_threads, "Number of worker threads (default: all cores)");
+    app.add_flag("--sched-stats", sched_stats,
+                 "At exit, print per worker thread the items, chunks, steals and busy/idle time of the parallel loops");
+    app.add_option("--mem-budget", mem_budget,
+                   "Memory for the dedup sets (or --orderly lists) of a build, e.g. 8G; beyond it sorted runs are "
+                   "spilled next to the output and merged (default: no limit)")
+        ->transform(CLI::AsSizeValue(false));
+    // let subcommands use the flags above, e.g. "ordinary 3:8 0:2 -b -e"
+    app.fallthrough();
 
+    Range o_loops;
+    Range o_defects;
+    auto* ordinary_cmd = app.add_subcommand("ordinary", "Ordinary graph complex: bases and contraction matrices by loop order and defect");
+    ordinary_cmd->add_option("range_loops", o_loops, "Range in format start:end")->required();
+    ordinary_cmd->add_option("range_defects", o_defects, "Range in format start:end")->required();
+
+    Range dd_loops;
+    Range dd_defects;
+    auto* dd_cmd = app.add_subcommand("dd", "Check that D o D = 0 for the ordinary contraction matrices (modulo a prime)");
+    dd_cmd->add_option("range_loops", dd_loops, "Range in format start:end")->required();
+    dd_cmd->add_option("range_defects", dd_defects, "Range of the defect of the domain of the first D, start:end")->required();
+
+    string validate_file;
+    int validate_defect = -1;
+    size_t max_reported = 20;
+    auto* validate_cmd = app.add_subcommand("validate", "Check every graph of a basis file: valence, simple, connected, "
+                                                         "defect, canonical form, sorted and unique");
+    validate_cmd->add_option("file", validate_file, "Basis file (.g6 with the number of graphs on the first line)")
+        ->required()
+        ->check(CLI::ExistingFile);
+    validate_cmd->add_option("--defect", validate_defect, "Expected defect 2E - 3V of all graphs (default: not checked)")
+        ->check(CLI::NonNegativeNumber);
+    validate_cmd->add_option("--max-errors", max_reported, "Number of problems to print (default 20)");
 
     CLI11_PARSE(app, argc, argv);
+    ProgressReporter::enabled = !no_progress;
+    parallel_num_threads_setting = num_threads;
+    OrdinaryGVS::orderly_generation = orderly;
+    KneisslerGVS::fixed_kernels = !generic_kernels;
+    g6_compress_setting = compress;
+    mem_budget_setting = mem_budget;
+    if (sched_stats) {
+        std::atexit([]() { print_parallel_worker_stats(std::cerr); });
+    }
+    try {
+        canon_backend = parse_canon_backend(canon);
+    } catch (const std::invalid_argument& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    size_t num_rank_primes = compute_rank ? num_primes : 0;
+
+    if (*ordinary_cmd) {
+        if (o_loops.start < 3 || o_loops.end < o_loops.start || o_defects.start < 0 || o_defects.end < o_defects.start) {
+            std::cerr << "Invalid range for loops or defects" << std::endl;
+            return 1;
+        }
+        for (int l = o_loops.start; l <= o_loops.end; ++l) {
+            for (int d = o_defects.start; d <= o_defects.end; ++d) {
+                OrdinaryGVS V(2 * l - 2 - d, l, even_edges);
+                if (!V.is_valid()) continue;
+                if (compute_bases) {
+                    tic();
+                    V.build_basis(overwrite);
+                    toc();
+                }
+                // contraction from defect d to defect d+1
+                if (compute_matrices) {
+                    OrdinaryContract D(V.num_vertices, l, even_edges);
+                    if (!D.is_valid()) continue;
+                    if (compute_bases) D.target.build_basis(overwrite);
+                    tic();
+                    D.build_matrix(overwrite, num_rank_primes);
+                    toc();
+                }
+            }
+        }
+        // report errors of the background writes
+        async_writer().flush();
+        return 0;
+    }
+    if (*validate_cmd) {
+        tic();
+        size_t num_issues = validate_basis_file(validate_file, validate_defect, max_reported);
+        toc();
+        return num_issues == 0 ? 0 : 2;
+    }
+    if (*dd_cmd) {
+        if (dd_loops.start < 3 || dd_loops.end < dd_loops.start || dd_defects.start < 0 || dd_defects.end < dd_defects.start) {
+            std::cerr << "Invalid range for loops or defects" << std::endl;
+            return 1;
+        }
+        bool all_zero = true;
+        for (int l = dd_loops.start; l <= dd_loops.end; ++l) {
+            for (int d = dd_defects.start; d <= dd_defects.end; ++d) {
+                int n = 2 * l - 2 - d;
+                OrdinaryContract D1(n, l, even_edges);
+                OrdinaryContract D2(n - 1, l, even_edges);
+                if (!D1.is_valid() || !D2.is_valid()) continue;
+                if (!D1.exists_matrix_file() || !D2.exists_matrix_file()) {
+                    std::cerr << "Missing matrices for " << D2.to_string() << " o " << D1.to_string()
+                              << ", build them with: ordinary " << l << ":" << l << " " << d << ":" << d + 1 << " -b -m"
+                              << (even_edges ? " -e" : "") << std::endl;
+                    all_zero = false;
+                    continue;
+                }
+                tic();
+                all_zero &= check_composition(D1, D2) == 0;
+                toc();
+            }
+        }
+        std::cout << (all_zero ? "D o D = 0 passed" : "D o D = 0 FAILED") << std::endl;
+        return all_zero ? 0 : 2;
+    }
+    if (app.count("range_loops") == 0 || app.count("range_types") == 0) {
+        std::cerr << "range_loops and range_types are required" << std::endl << app.help() << std::endl;
+        return 1;
+    }
 
     // Check if the ranges are valid
     if (r_loops.start < 0 || r_loops.end < r_loops.start) {
@@ -64,6 +208,7 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    bool verified_ok = true;
     for (int l =r_loops.start; l <= r_loops.end; ++l) {
         for (int k = r_types.start; k <= r_types.end; ++k) {
             // for (bool even_edges : {true}) {
@@ -74,18 +219,31 @@ int main(int argc, char** argv) {
                 gvs.build_basis(overwrite);
                 toc();
             }
-            // test_basis_vs_ref(gvs);
+            if (verify) {
+                tic();
+                verified_ok &= test_basis_vs_ref(gvs);
+                toc();
+            }
 
             if (compute_matrices && k>=2) {
                 KneisslerContract D(l,k, even_edges);
                 tic();
-                D.build_matrix(overwrite);
+                D.build_matrix(overwrite, num_rank_primes);
                 toc();
-            //     test_matrix_vs_ref(D);
+                if (verify) {
+                    tic();
+                    verified_ok &= test_matrix_vs_ref(D);
+                    toc();
+                }
             }
             
         }
     }
 
+    async_writer().flush();
+    if (verify) {
+        std::cout << (verified_ok ? "Verification passed" : "Verification FAILED") << std::endl;
+        return verified_ok ? 0 : 2;
+    }
     return 0;
 }
\ No newline at end of file
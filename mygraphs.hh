@@ -3,9 +3,17 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 #include <stdexcept>
 #include <cstdint>
 #include "bliss/graph.hh"
+#include "bliss/defs.hh"
+#include "instrument.hh"
+#include "Arena.hh"
+#include "ExternalDedup.hh"
+#include "G6File.hh"
+#include "OutputFile.hh"
+#include "SmallVec.hh"
 #include <algorithm>
 #include <iostream>
 #include <fstream>
@@ -14,11 +22,89 @@
 
 #include <random>
 #include <cassert>
+#include <filesystem>
+#include <functional>
+#include <memory>
+
+#ifdef GGEN_WITH_NAUTY
+#include "nauty_canon.hh"
+#endif
 
 using namespace std;
 
-template <typename T>
-int permutation_sign(const std::vector<T>& p) {
+inline void ensure_folder_of_filename_exists(const string& filename) {
+    size_t pos = filename.find_last_of("/\\");
+    if (pos != string::npos) {
+        string folder = filename.substr(0, pos);
+        if (!std::filesystem::exists(folder)) {
+            std::filesystem::create_directories(folder);
+        }
+    }
+}
+
+inline string get_type_string(bool even_edges) {
+    return even_edges ? "even_edges" : "odd_edges";
+}
+
+// Canonical labeling backends. Every backend produces its own canonical forms, so all graphs
+// compared with each other (e.g. bases and matrices of one complex) must come from the same
+// backend; select it once at startup.
+enum class CanonBackend {
+    Bliss,
+    Nauty,        // dense nauty
+    SparseNauty,
+    Traces
+};
+
+inline CanonBackend canon_backend = CanonBackend::Bliss;
+
+inline const char* canon_backend_name(CanonBackend b) {
+    switch (b) {
+        case CanonBackend::Bliss: return "bliss";
+        case CanonBackend::Nauty: return "nauty";
+        case CanonBackend::SparseNauty: return "sparsenauty";
+        case CanonBackend::Traces: return "traces";
+    }
+    return "?";
+}
+
+inline std::vector<CanonBackend> available_canon_backends() {
+#ifdef GGEN_WITH_NAUTY
+    return {CanonBackend::Bliss, CanonBackend::Nauty, CanonBackend::SparseNauty, CanonBackend::Traces};
+#else
+    return {CanonBackend::Bliss};
+#endif
+}
+
+inline CanonBackend parse_canon_backend(const std::string& name) {
+    for (CanonBackend b : {CanonBackend::Bliss, CanonBackend::Nauty, CanonBackend::SparseNauty, CanonBackend::Traces}) {
+        if (name != canon_backend_name(b)) continue;
+        auto avail = available_canon_backends();
+        if (std::find(avail.begin(), avail.end(), b) == avail.end()) {
+            throw std::invalid_argument("Canonicalizer " + name + " is not available in this build (make NAUTY=1)");
+        }
+        return b;
+    }
+    throw std::invalid_argument("Unknown canonicalizer: " + name);
+}
+
+// Identifies the canonical labeling in caches of canonical forms; forms computed by different
+// canonicalizers are not comparable.
+inline std::string canonicalizer_name() {
+    return canon_backend_name(canon_backend);
+}
+
+// canonicalizer_name() and the version of the library behind it, e.g. "bliss-0.77": a new
+// version of bliss or nauty may change the canonical forms, so outputs record this.
+inline std::string canonicalizer_version() {
+#ifdef GGEN_WITH_NAUTY
+    if (canon_backend != CanonBackend::Bliss) return canonicalizer_name() + "-" + NAUTYVERSION;
+#endif
+    return canonicalizer_name() + "-" + bliss::version;
+}
+
+template <typename T, typename A>
+int permutation_sign(const std::vector<T, A>& p) {
     int sign = 1;
     for (size_t i = 0; i < p.size(); ++i) {
         for (size_t j = i + 1; j < p.size(); ++j) {
@@ -28,41 +114,46 @@ int permutation_sign(const std::vector<T>& p) {
     return sign;
 }
 
-template <typename T>
-vector<T> inverse_permutation(const std::vector<T>& p) {
-    vector<T> inv(p.size());
+template <typename T, typename A>
+vector<T, A> inverse_permutation(const std::vector<T, A>& p) {
+    vector<T, A> inv(p.size());
     for (size_t i = 0; i < p.size(); ++i) {
         inv[p[i]] = i;
     }
     return inv;
 }
 
-template <typename T>
-void print_perm(const std::vector<T>& p) {
+template <typename T, typename A>
+void print_perm(const std::vector<T, A>& p) {
     for (size_t i = 0; i < p.size(); ++i) {
         std::cout << (int)p[i] << " ";
     }
     std::cout << "\n";
 }
 
-// Permute the pair (u, v) to the left of the vertex_range and return the induced permutation (inverse)
-inline std::vector<uint8_t> permute_to_left(uint8_t u, uint8_t v, size_t n) {
-    std::vector<uint8_t> p(n);
-    p[0] = u;
-    p[1] = v;
-    size_t idx = 2;
+// Scratch vertex permutation (p[v] is the image of v) of the search and sign kernels. It is on
+// the thread's arena (see Arena.hh), so only locals that die where they were made may use it;
+// labelings that are returned or stored are plain vectors.
+using ScratchPermutation = ArenaVector<uint8_t>;
+
+// Write to p the permutation that brings the pair (u, v) to the left of the vertex range, keeping
+// the order of the other vertices (the inverse of u, v, 0, 1, ... without u and v)
+inline void permute_to_left(uint8_t u, uint8_t v, size_t n, ScratchPermutation& p) {
+    p.resize(n);
+    p[u] = 0;
+    p[v] = 1;
+    uint8_t idx = 2;
     for (uint8_t j = 0; j < n; ++j) {
         if (j == u || j == v) continue;
-        p[idx++] = j;
+        p[j] = idx++;
     }
-    // Return the inverse permutation
-    return inverse_permutation(p);
 }
 
+// 3 bytes, no padding; data is a small label such as the index of the edge (see number_edges).
 struct Edge {
     uint8_t u, v;
-    int data = 0;
-    Edge(uint8_t u_, uint8_t v_, int data_ = 0) : u(u_), v(v_), data(data_) {}
+    uint8_t data = 0;
+    Edge(uint8_t u_, uint8_t v_, uint8_t data_ = 0) : u(u_), v(v_), data(data_) {}
     bool operator<(const Edge& other) const {
         return std::tie(u, v) < std::tie(other.u, other.v);
     }
@@ -80,17 +171,54 @@ struct Edge {
     }
 };
 
+// Result of a fused canonicalization: canonical g6 code, sign of the canonical relabeling,
+// and whether the graph has an automorphism acting by -1 on the orientation.
+struct CanonicalForm {
+    std::string g6;
+    int sign = 1;
+    bool odd_automorphism = false;
+};
+
+// Vertex colors for a partition of the vertices {0,...,n-1}: the vertices in block i get color i.
+// Colored canonical forms keep the color classes in order, i.e., the canonical labels of the
+// block i vertices come before those of block i+1, so for spaces whose partition consists of
+// consecutive ranges the canonical g6 code alone identifies the colored graph.
+// A partition with at most one block gives no colors (the uncolored fast path).
+inline std::vector<unsigned> partition_to_colors(const std::vector<std::vector<uint8_t>>& partition) {
+    if (partition.size() <= 1) return {};
+    size_t n = 0;
+    for (const auto& block : partition) n += block.size();
+    std::vector<unsigned> colors(n, ~0u);
+    for (size_t i = 0; i < partition.size(); ++i) {
+        for (uint8_t v : partition[i]) {
+            if (v >= n || colors[v] != ~0u) throw std::invalid_argument("Not a partition of the vertices");
+            colors[v] = i;
+        }
+    }
+    return colors;
+}
+
+// Edge list with inline storage for up to 64 edges, enough for all graphs of the Kneissler and
+// ordinary complexes up to loop order 16, so copying a graph does not allocate.
+typedef SmallVec<Edge, 64> EdgeList;
+
 class Graph {
 public:
     uint8_t num_vertices;
-    std::vector<Edge> edges;
+    EdgeList edges;
 
     Graph(uint8_t n) : num_vertices(n) {}
 
-    Graph(uint8_t n, const std::vector<Edge>& e)
+    Graph(uint8_t n, const EdgeList& e)
         : num_vertices(n), edges(e) {}
 
-    void add_edge(uint8_t u, uint8_t v, int data = 0) {
+    Graph(uint8_t n, EdgeList&& e)
+        : num_vertices(n), edges(std::move(e)) {}
+
+    Graph(uint8_t n, const std::vector<Edge>& e)
+        : num_vertices(n), edges(e.begin(), e.end()) {}
+
+    void add_edge(uint8_t u, uint8_t v, uint8_t data = 0) {
         if (u < v)
             edges.emplace_back(u, v, data);
         else
@@ -98,11 +226,13 @@ public:
     }
 
     std::string to_g6() const {
+        INSTR_SCOPE(G6Encoding);
         uint8_t n = num_vertices;
         if (n > 62) throw std::runtime_error("Only supports graphs with at most 62 vertices.");
         std::string result;
         result.push_back(static_cast<char>(n + 63));
-        std::vector<uint8_t> bitvec;
+        ArenaVector<uint8_t> bitvec;
+        bitvec.reserve(n * (n - 1) / 2 + 5);
         for (uint8_t j = 1; j < n; ++j) {
             for (uint8_t i = 0; i < j; ++i) {
                 bool found = false;
@@ -126,43 +256,41 @@ public:
         return result;
     }
 
-    string to_canon_g6() const {
-        // use bliss to get the canonical labeling of the graph and return its g6
-        bliss::Graph blissG = to_bliss_graph();
-        bliss::Stats stats;
-        const unsigned int* perm = blissG.canonical_form(stats);
-        std::vector<uint8_t> new_labels(num_vertices);
-        for (size_t i = 0; i < num_vertices; ++i) {
-            new_labels[i] = perm[i];
-        }
+    // The colors argument of the canonicalization functions is a vertex coloring as returned by
+    // partition_to_colors; automorphisms and canonical labelings respect it. Empty means uncolored.
+    string to_canon_g6(const std::vector<unsigned>& colors = {}) const {
+        // get the canonical labeling of the graph and return its g6
+        ScratchPermutation new_labels;
+        search_automorphisms(colors, true, nullptr, new_labels);
         Graph canonG = Graph(num_vertices, edges);
-        canonG.relabel(new_labels);
+        {
+            INSTR_SCOPE(GraphConstruction);
+            canonG.relabel(new_labels);
+        }
         return canonG.to_g6();
     }
 
-    std::pair<string, int> to_canon_g6_sgn(bool even_edges) const {
-        // use bliss to get the canonical labeling of the graph and return its g6
-        bliss::Graph blissG = to_bliss_graph();
-        bliss::Stats stats;
-        const unsigned int* perm = blissG.canonical_form(stats);
-        std::vector<uint8_t> new_labels(num_vertices);
-        for (size_t i = 0; i < num_vertices; ++i) {
-            new_labels[i] = perm[i];
-        }
+    std::pair<string, int> to_canon_g6_sgn(bool even_edges, const std::vector<unsigned>& colors = {}) const {
+        // get the canonical labeling of the graph and return its g6
+        ScratchPermutation new_labels;
+        search_automorphisms(colors, true, nullptr, new_labels);
         int sign = perm_sign(new_labels, even_edges);
         Graph canonG = Graph(num_vertices, edges);
-        canonG.relabel(new_labels);
+        {
+            INSTR_SCOPE(GraphConstruction);
+            canonG.relabel(new_labels);
+        }
         return {canonG.to_g6(), sign};
     }
 
-    bool has_odd_automorphism(bool even_edges) const {
+    bool has_odd_automorphism(bool even_edges, const std::vector<unsigned>& colors = {}) const {
         // cout << "bliss0 "<< to_g6() << endl;
-        bliss::Graph blissG = to_bliss_graph();
         bool ret = false;
 
         //std::vector<std::vector<unsigned>> generators;
         auto callback = [&](unsigned n, const unsigned* perm) {
-            vector<uint8_t> p(n);
+            INSTR_COUNT(AutomorphismGenerators, 1);
+            ScratchPermutation p(n);
             for (size_t i = 0; i < n; ++i) {
                 p[i] = perm[i];
             }
@@ -176,8 +304,7 @@ public:
             //generators.emplace_back(perm, perm + n);
         };
         // cout << "bliss "<< to_g6() << endl;
-        bliss::Stats stats;
-        blissG.find_automorphisms(stats, callback);  // Modern Bliss: expects std::function
+        search_automorphisms(colors, false, callback);
 
         // for (const auto& perm : generators) {
         //     for (auto x : perm) std::cout << x << " ";
@@ -187,12 +314,50 @@ public:
     }
 
 
+    // to_canon_g6_sgn and has_odd_automorphism in one bliss search: the generators reported
+    // while computing the canonical labeling generate the full automorphism group.
+    CanonicalForm canonical_form(bool even_edges, const std::vector<unsigned>& colors = {}) const {
+        return canonical_form_with([&](const ScratchPermutation& p) { return perm_sign(p, even_edges); }, colors);
+    }
+
+    // Same as canonical_form, for an arbitrary sign rule sign(p) of vertex permutations.
+    template <typename SignRule>
+    CanonicalForm canonical_form_with(SignRule&& sign, const std::vector<unsigned>& colors = {}) const {
+        return canonical_form_with(sign, colors, [](const Graph& g) { return g.to_g6(); });
+    }
+
+    // encode(G) returns the g6 code of G, e.g. from a specialized kernel.
+    template <typename SignRule, typename Encode>
+    CanonicalForm canonical_form_with(SignRule&& sign, const std::vector<unsigned>& colors, Encode&& encode) const {
+        CanonicalForm result;
+        auto callback = [&](unsigned n, const unsigned* perm) {
+            INSTR_COUNT(AutomorphismGenerators, 1);
+            if (result.odd_automorphism) return;
+            ScratchPermutation p(perm, perm + n);
+            if (sign(p) != 1) {
+                result.odd_automorphism = true;
+            }
+        };
+        ScratchPermutation new_labels;
+        search_automorphisms(colors, true, callback, new_labels);
+        if (!colors.empty()) check_color_order(new_labels, colors);
+        result.sign = sign(new_labels);
+        Graph canonG = Graph(num_vertices, edges);
+        {
+            INSTR_SCOPE(GraphConstruction);
+            canonG.relabel(new_labels);
+        }
+        result.g6 = encode(canonG);
+        return result;
+    }
+
     Graph add_edge_across(size_t e1idx, size_t e2idx) const {
+        INSTR_SCOPE(GraphConstruction);
         if (e1idx == e2idx) throw std::invalid_argument("Edges must be distinct");
         uint8_t new_n = num_vertices + 2;
         uint8_t v1 = num_vertices;
         uint8_t v2 = num_vertices + 1;
-        std::vector<Edge> new_edges;
+        EdgeList new_edges;
         for (size_t i = 0; i < edges.size(); ++i) {
             auto [u, v, data] = edges[i];
             if (i == e1idx) {
@@ -207,14 +372,15 @@ public:
             }
         }
         std::sort(new_edges.begin(), new_edges.end());
-        return Graph(new_n, new_edges);
+        return Graph(new_n, std::move(new_edges));
     }
 
     Graph replace_edge_by_tetra(size_t eidx) const {
+        INSTR_SCOPE(GraphConstruction);
         uint8_t new_n = num_vertices + 4;
         auto [u, v, data] = edges[eidx];
         if (!(u < v)) throw std::invalid_argument("Edge must be (u < v)");
-        std::vector<Edge> new_edges;
+        EdgeList new_edges;
         for (size_t i = 0; i < edges.size(); ++i) {
             auto [a, b, d] = edges[i];
             if (i == eidx) {
@@ -234,39 +400,46 @@ public:
             }
         }
         std::sort(new_edges.begin(), new_edges.end());
-        return Graph(new_n, new_edges);
+        return Graph(new_n, std::move(new_edges));
     }
 
     Graph union_with(const Graph& other) const {
+        INSTR_SCOPE(GraphConstruction);
         uint8_t new_n = num_vertices + other.num_vertices;
-        std::vector<Edge> new_edges = edges;
+        EdgeList new_edges = edges;
         for (const auto& e : other.edges) {
             new_edges.emplace_back(e.u + num_vertices, e.v + num_vertices, e.data);
         }
-        return Graph(new_n, new_edges);
+        return Graph(new_n, std::move(new_edges));
     }
 
     Graph contract_edge(size_t eidx) const {
+        INSTR_SCOPE(GraphConstruction);
         if (num_vertices < 2) throw std::invalid_argument("Not enough vertices to contract");
         uint8_t new_n = num_vertices - 1;
         auto [u, v, data] = edges[eidx];
         if (!(u < v)) throw std::invalid_argument("Edge must be (u < v)");
-        std::set<Edge> edge_set;
+        EdgeList new_edges;
         for (size_t i = 0; i < edges.size(); ++i) {
             if (i == eidx) continue;
             auto [a, b, d] = edges[i];
             uint8_t aa = (a < v) ? a : (a == v ? u : a - 1);
             uint8_t bb = (b < v) ? b : (b == v ? u : b - 1);
             if (aa < bb)
-                edge_set.emplace(aa, bb, d);
+                new_edges.emplace_back(aa, bb, d);
             else if (bb < aa)
-                edge_set.emplace(bb, aa, d);
+                new_edges.emplace_back(bb, aa, d);
         }
-        std::vector<Edge> new_edges(edge_set.begin(), edge_set.end());
-        return Graph(new_n, new_edges);
+        // sorted, merging multiple edges (the first one is kept)
+        std::stable_sort(new_edges.begin(), new_edges.end());
+        auto last = std::unique(new_edges.begin(), new_edges.end(),
+                                [](const Edge& x, const Edge& y) { return x.u == y.u && x.v == y.v; });
+        new_edges.erase(last, new_edges.end());
+        return Graph(new_n, std::move(new_edges));
     }
 
-    static Graph from_g6(const std::string& g6) {
+    static Graph from_g6(std::string_view g6) {
+        INSTR_SCOPE(G6Encoding);
         if (g6.empty()) throw std::invalid_argument("Empty g6 string");
         uint8_t first = static_cast<uint8_t>(g6[0]);
         if (first < 63) throw std::invalid_argument("Invalid graph6 string");
@@ -274,7 +447,8 @@ public:
         size_t num_bits = n * (n - 1) / 2;
         size_t num_bytes = (num_bits + 5) / 6;
         if (g6.size() < 1 + num_bytes) throw std::invalid_argument("g6 string too short");
-        std::vector<uint8_t> bits;
+        ArenaVector<uint8_t> bits;
+        bits.reserve(6 * num_bytes);
         for (size_t i = 0; i < num_bytes; ++i) {
             uint8_t val = static_cast<uint8_t>(g6[1 + i]);
             if (val < 63) throw std::invalid_argument("Invalid graph6 data byte");
@@ -284,7 +458,7 @@ public:
             }
         }
         bits.resize(num_bits);
-        std::vector<Edge> edges;
+        EdgeList edges;
         size_t k = 0;
         for (uint8_t j = 1; j < n; ++j) {
             for (uint8_t i = 0; i < j; ++i) {
@@ -293,54 +467,94 @@ public:
                 }
             }
         }
-        return Graph(n, edges);
+        return Graph(n, std::move(edges));
     }
 
+    // Write the list with its length on the first line, or front-coded with g6_compress_setting;
+    // see OutputFile for the crash safety.
     static void save_to_file(const std::vector<std::string>& g6_list, const std::string& filename) {
-        std::ofstream file(filename);
-        if (!file) throw std::runtime_error("Failed to open file for writing");
-        file << g6_list.size() << "\n";
-        for (const auto& g6 : g6_list) {
-            file << g6 << "\n";
+        INSTR_SCOPE(IO);
+        OutputFile out(filename);
+        out.commit(write_g6_list(out, g6_list));
+    }
+
+    // As save_to_file, on the background writer thread; see AsyncWriter::submit for on_commit.
+    static void save_to_file_async(std::vector<std::string> g6_list, const std::string& filename,
+                                   std::function<void(const OutputSummary&)> on_commit = nullptr) {
+        auto list = std::make_shared<const std::vector<std::string>>(std::move(g6_list));
+        async_writer().submit(filename, [list](OutputFile& out) { return write_g6_list(out, *list); },
+                              std::move(on_commit));
+    }
+
+    // A list spilled under a memory budget is streamed from its file and removed afterwards.
+    static void save_to_file_async(SortedG6List g6_list, const std::string& filename,
+                                   std::function<void(const OutputSummary&)> on_commit = nullptr) {
+        auto list = std::make_shared<const SortedG6List>(std::move(g6_list));
+        async_writer().submit(filename, [list](OutputFile& out) { return write_g6_list(out, *list); },
+                              std::move(on_commit));
+    }
+
+    static uint64_t write_g6_list(OutputFile& out, const SortedG6List& g6_list) {
+        if (g6_list.in_memory()) return write_g6_list(out, g6_list.get_records());
+        if (g6_compress_setting) {
+            // the header needs the encoded size, so encode twice
+            FrontCodedEncoder sizing;
+            g6_list.for_each([&](string_view g6) { sizing.add(g6, [](string_view) {}); });
+            out.write(sizing.header());
+            FrontCodedEncoder enc;
+            g6_list.for_each([&](string_view g6) { enc.add(g6, [&](string_view bytes) { out.write(bytes); }); });
+            out.write(enc.get_index());
+        } else {
+            out.write_uint(g6_list.size());
+            out.write('\n');
+            g6_list.for_each([&](string_view g6) {
+                out.write(g6);
+                out.write('\n');
+            });
         }
+        return g6_list.size();
+    }
+
+    static uint64_t write_g6_list(OutputFile& out, const std::vector<std::string>& g6_list) {
+        if (g6_compress_setting) {
+            out.write(encode_front_coded(g6_list));
+        } else {
+            out.write_uint(g6_list.size());
+            out.write('\n');
+            for (const auto& g6 : g6_list) {
+                out.write(g6);
+                out.write('\n');
+            }
+        }
+        return g6_list.size();
     }
 
     static std::vector<std::string> load_from_file(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file) throw std::runtime_error("Failed to open file for reading");
-        size_t num_graphs;
-        file >> num_graphs;
-        std::string line;
-        std::getline(file, line); // consume rest of first line
-        std::vector<std::string> g6_list;
-        while (std::getline(file, line)) {
-            if (!line.empty())
-                g6_list.push_back(line);
-        }
-        if (g6_list.size() != num_graphs)
-            throw std::runtime_error("Number of graphs in file does not match the first line");
-        return g6_list;
+        return G6File(filename).strings();
     }
 
     static std::vector<std::string> load_from_file_nohdr(const std::string& filename) {
-        std::ifstream file(filename);
-        if (!file) throw std::runtime_error("Failed to open file for reading");
-        std::vector<std::string> g6_list;
-        std::string line;
-        while (std::getline(file, line)) {
-            if (!line.empty())
-                g6_list.push_back(line);
-        }
-        return g6_list;
+        return G6File(filename, false).strings();
+    }
+
+    // Decode all graphs of a file in the format of save_to_file, in parallel and straight from
+    // the mapped file.
+    static std::vector<Graph> load_graphs_from_file(const std::string& filename) {
+        G6File file(filename);
+        std::vector<Graph> graphs(file.size(), Graph(0));
+        parallel_for(file.size(), [&](size_t i, unsigned) {
+            graphs[i] = from_g6(file[i]);
+        });
+        return graphs;
     }
 
     static Graph tetrahedron_graph() {
-        return Graph(4, {Edge(0,1), Edge(0,2), Edge(0,3), Edge(1,2), Edge(1,3), Edge(2,3)});
+        return Graph(4, EdgeList{Edge(0,1), Edge(0,2), Edge(0,3), Edge(1,2), Edge(1,3), Edge(2,3)});
     }
 
     static Graph tetrastring_graph(uint8_t n_blocks) {
         uint8_t n = 4 * n_blocks;
-        std::vector<Edge> edges;
+        EdgeList edges;
         for (uint8_t i = 0; i < n_blocks; ++i) {
             edges.emplace_back(4 * i, 4 * i + 1);
             edges.emplace_back(4 * i, 4 * i + 2);
@@ -353,26 +567,98 @@ public:
                 edges.emplace_back(4 * i + 3, 4 * i + 4);
             }
         }
-        return Graph(n, edges);
+        return Graph(n, std::move(edges));
     }
 
     void print() const {
         std::cout << "Graph with " << (int)num_vertices << " vertices and " << edges.size()
                   << " edges. G6 code: " << to_g6() << ".\n";
         for (const auto& e : edges) {
-            std::cout << (int)e.u << " " << (int)e.v << " " << e.data << "\n";
+            std::cout << (int)e.u << " " << (int)e.v << " " << (int)e.data << "\n";
         }
     }
 
-    bliss::Graph to_bliss_graph() const {
+    bliss::Graph to_bliss_graph(const std::vector<unsigned>& colors = {}) const {
+        INSTR_SCOPE(GraphConstruction);
         bliss::Graph g(num_vertices);
+        if (!colors.empty()) {
+            if (colors.size() != num_vertices) throw std::invalid_argument("Vertex coloring has the wrong size");
+            for (size_t v = 0; v < num_vertices; ++v) {
+                if (colors[v] != 0) g.change_color(v, colors[v]);
+            }
+        }
         for (const auto& e : edges) {
             g.add_edge(e.u, e.v);
         }
         return g;
     }
 
-    void relabel(const std::vector<uint8_t>& new_labels) {
+    // Run the selected canonicalization backend. The generators of the automorphism group are
+    // passed to report(n, perm) during the search. Returns the canonical labeling (new_labels[v]
+    // is the canonical label of v) if getcanon is set, otherwise an empty vector.
+    std::vector<uint8_t> search_automorphisms(const std::vector<unsigned>& colors, bool getcanon,
+                                              const std::function<void(unsigned, const unsigned*)>& report) const {
+        std::vector<uint8_t> new_labels;
+        search_automorphisms(colors, getcanon, report, new_labels);
+        return new_labels;
+    }
+
+    // Same, writing the canonical labeling to new_labels, e.g. a ScratchPermutation.
+    template <typename Labels>
+    void search_automorphisms(const std::vector<unsigned>& colors, bool getcanon,
+                              const std::function<void(unsigned, const unsigned*)>& report, Labels& new_labels) const {
+        new_labels.clear();
+#ifdef GGEN_WITH_NAUTY
+        if (canon_backend != CanonBackend::Bliss) {
+            if (!colors.empty() && colors.size() != num_vertices) {
+                throw std::invalid_argument("Vertex coloring has the wrong size");
+            }
+            ArenaVector<std::pair<int, int>> nedges;
+            nedges.reserve(edges.size());
+            for (const auto& e : edges) nedges.emplace_back(e.u, e.v);
+            NautyMode mode = canon_backend == CanonBackend::Nauty         ? NautyMode::Dense
+                             : canon_backend == CanonBackend::SparseNauty ? NautyMode::Sparse
+                                                                           : NautyMode::Traces;
+            ArenaVector<unsigned> labels(getcanon ? num_vertices : 0);
+            unsigned long nodes;
+            {
+                INSTR_SCOPE(BlissSearch);
+                nodes = nauty_canonical_labeling(mode, num_vertices, nedges, colors, getcanon, labels.data(), report);
+            }
+            INSTR_COUNT(BlissCalls, 1);
+            INSTR_COUNT(BlissNodes, nodes);
+            (void)nodes;
+            new_labels.assign(labels.begin(), labels.end());
+            return;
+        }
+#endif
+        bliss::Graph blissG = to_bliss_graph(colors);
+        bliss::Stats stats;
+        {
+            INSTR_SCOPE(BlissSearch);
+            if (getcanon) {
+                const unsigned int* perm = blissG.canonical_form(stats, report);
+                new_labels.assign(perm, perm + num_vertices);
+            } else {
+                blissG.find_automorphisms(stats, report);
+            }
+        }
+        INSTR_COUNT(BlissCalls, 1);
+        INSTR_COUNT(BlissNodes, stats.get_nof_nodes());
+    }
+
+    // The color classes must stay consecutive in the canonical labeling, otherwise the canonical
+    // g6 code would not determine the coloring.
+    static void check_color_order(const ScratchPermutation& new_labels, const std::vector<unsigned>& colors) {
+        ArenaVector<unsigned> canon_colors(colors.size());
+        for (size_t v = 0; v < colors.size(); ++v) canon_colors[new_labels[v]] = colors[v];
+        if (!std::is_sorted(canon_colors.begin(), canon_colors.end())) {
+            throw std::runtime_error("Canonical labeling does not keep the color classes in order");
+        }
+    }
+
+    template <typename Labels>
+    void relabel(const Labels& new_labels) {
         if (new_labels.size() != num_vertices) throw std::invalid_argument("Invalid relabeling vector size");
         for (auto& e : edges) {
             e.u = new_labels[e.u];
@@ -392,12 +678,14 @@ public:
     void number_edges() { 
         // sort edges and assign data the position in the ordered list
         sort_edges();
+        if (edges.size() > 256) throw std::runtime_error("Too many edges to number");
         for (size_t i = 0; i < edges.size(); ++i) {
             edges[i].data = i;
         }
     }
 
-    int perm_sign(const std::vector<uint8_t>& p, bool even_edges) const {
+    int perm_sign(const ScratchPermutation& p, bool even_edges) const {
+        INSTR_SCOPE(SignComputation);
         if (even_edges) {
             // Sign of the vertex permutation
             int sign = permutation_sign(p);
@@ -415,11 +703,7 @@ public:
             // Graph G2(G1.num_vertices, G1.edges);
             G1.relabel(p);
             G1.sort_edges();
-            std::vector<int> perm;
-            for (const auto& e : G1.edges) {
-                perm.push_back(e.data);
-            }
-            int sign = permutation_sign(perm);
+            int sign = edge_label_sign(G1.edges);
             // if (sign !=1) {
             //     cout << "Permutation (perm_sign): ";
             //     print_perm(perm);
@@ -433,6 +717,17 @@ public:
         }
     }
 
+    // Sign of the permutation given by the data labels of the edges in their current order.
+    static int edge_label_sign(const EdgeList& edges) {
+        int sign = 1;
+        for (size_t i = 0; i < edges.size(); ++i) {
+            for (size_t j = i + 1; j < edges.size(); ++j) {
+                if (edges[i].data > edges[j].data) sign = -sign;
+            }
+        }
+        return sign;
+    }
+
     void print_edges() {
         for (const auto& e : edges) {
             std::cout << (int)e.u << " " << (int)e.v << " " << (int)e.data << "\n";
@@ -443,18 +738,14 @@ public:
     // }
 
     vector<pair<Graph, int>> get_contractions_with_sign(bool even_edges) const {
+        INSTR_SCOPE(GraphConstruction);
         vector<pair<Graph, int>> image;
         for (size_t i = 0; i < edges.size(); ++i) {
             // Contract edge i
             auto [u, v, data] = edges[i];
-            // Create permutation that brings u,v to 0,1
-            vector<uint8_t> pp(num_vertices);
-            iota(pp.begin(), pp.end(), 0);
-            if (u != 0) swap(pp[0], pp[u]);
-            if (v == 0) swap(pp[1], pp[u]);
-            else if (v != 1) swap(pp[1], pp[v]);
-
-            pp = permute_to_left(u, v, num_vertices);
+            // Permutation that brings u,v to 0,1
+            ScratchPermutation pp;
+            permute_to_left(u, v, num_vertices, pp);
             // Compute sign
             int sgn = perm_sign(pp, even_edges);
             // Relabel and contract
@@ -474,10 +765,9 @@ public:
             // G1.relabel(relab);
             if (!even_edges) {
                 // Compute sign from edge permutation
-                vector<int> p;
+                // the edge with label 0 was contracted, the labels of the others are 1, 2, ...
                 G1.sort_edges();
-                for (const auto& e : G1.edges) p.push_back(e.data-1); // the edge with label 1 was contracted
-                sgn *= permutation_sign(p);
+                sgn *= edge_label_sign(G1.edges);
             } else {
                 sgn *= -1;
             }
@@ -494,76 +784,63 @@ public:
         // return contractions;
     }
 
-    bool check_valid(size_t defect, string err_msg) const {
-        // check whether all vertex indices are < num_vertices
+    // Empty if the graph is simple with sorted edges (u < v), connected, at least 3-valent and,
+    // unless defect < 0, of the given defect 2E - 3V; otherwise a description of the first
+    // violation found. Works on adjacency bit sets: O(V^2 / 64 + E).
+    string validity_error(int defect = -1) const {
+        size_t n = num_vertices;
+        size_t words = (n + 63) / 64;
+        ArenaVector<uint64_t> adj(n * words, 0);
         for (const auto& e : edges) {
-            if (e.u >= num_vertices || e.v >= num_vertices) {
-                std::cerr << err_msg << " Graph " << to_g6() << " has vertex index >= num_vertices\n";
-                return false;
-            }
+            if (e.u >= n || e.v >= n) return "has vertex index >= num_vertices";
+            if (e.u == e.v) return "has self-edge " + std::to_string(e.u);
+            if (e.u > e.v) return "has wrongly ordered edge " + std::to_string(e.u) + " " + std::to_string(e.v);
+            uint64_t& w = adj[e.u * words + e.v / 64];
+            uint64_t bit = uint64_t(1) << (e.v % 64);
+            if (w & bit) return "has multiple edges " + std::to_string(e.u) + " " + std::to_string(e.v);
+            w |= bit;
+            adj[e.v * words + e.u / 64] |= uint64_t(1) << (e.u % 64);
         }
-        // check whether all vertices are $\geq 3-valent
-        for (size_t i = 0; i < num_vertices; ++i) {
-            size_t degree = 0;
-            for (const auto& e : edges) {
-                if (e.u == i || e.v == i) degree++;
-            }
-            if (degree < 3) {
-                std::cerr << err_msg << " Graph " << to_g6() << " Vertex " << i << " has degree " << degree << "\n";
-                return false;
-            }
+        for (size_t v = 0; v < n; ++v) {
+            int degree = 0;
+            for (size_t w = 0; w < words; ++w) degree += __builtin_popcountll(adj[v * words + w]);
+            if (degree < 3) return "vertex " + std::to_string(v) + " has degree " + std::to_string(degree);
         }
-        // there are no multiple edges or self-edges
-        for (auto [u,v,data] : edges) {
-            if (u == v) {
-                std::cerr << err_msg << " Graph " << to_g6() << " has self-edge " << (int) u << "\n";
-                return false;
-            }
-            if (u > v) {
-                std::cerr << err_msg << " Graph " << to_g6() << " has wrongly ordered edge " << (int) u << " " << (int) v << "\n";
-                return false;
-            }
-            int cnt = 0;
-            for (auto [u2,v2,data2] : edges) {
-                if (u == u2 && v == v2) {
-                    cnt++;
-                    if (cnt > 1){
-                        std::cerr << err_msg << " Graph " << to_g6() << " has multiple edges " << (int) u << " " << (int) v << "\n";
-                        return false;
-                    }
+        if (n > 0) {
+            // grow the component of vertex 0, a word of the adjacency matrix at a time
+            ArenaVector<uint64_t> seen(words, 0), todo(words, 0);
+            seen[0] = todo[0] = 1;
+            size_t reached = 1;
+            for (size_t w = 0; w < words;) {
+                if (todo[w] == 0) {
+                    ++w;
+                    continue;
                 }
-            }
-        }
-        // check whether the graph is connected
-        std::vector<bool> visited(num_vertices, false);
-        std::vector<uint8_t> stack;
-        stack.push_back(0);
-        while (!stack.empty()) {
-            uint8_t v = stack.back();
-            stack.pop_back();
-            if (visited[v]) continue;
-            visited[v] = true;
-            for (const auto& e : edges) {
-                if (e.u == v && !visited[e.v]) {
-                    stack.push_back(e.v);
-                } else if (e.v == v && !visited[e.u]) {
-                    stack.push_back(e.u);
+                size_t v = 64 * w + __builtin_ctzll(todo[w]);
+                todo[w] &= todo[w] - 1;
+                for (size_t x = 0; x < words; ++x) {
+                    uint64_t fresh = adj[v * words + x] & ~seen[x];
+                    if (fresh == 0) continue;
+                    seen[x] |= fresh;
+                    todo[x] |= fresh;
+                    reached += __builtin_popcountll(fresh);
+                    if (x < w) w = x;
                 }
             }
+            if (reached != n) return "is not connected";
         }
-        for (size_t i = 0; i < num_vertices; ++i) {
-            if (!visited[i]) {
-                std::cerr << err_msg << " Graph " << to_g6() << " is not connected\n";
-                return false;
-            }
-        }
-        // check if defect = 2edges -3vertices
-        if (defect +3*num_vertices != 2*edges.size()) {
-            int true_defect = 2*edges.size() - 3*num_vertices;
-            std::cerr << err_msg << " Graph " << to_g6() << " has defect " << true_defect << "(not "<<defect<< ")\n";
-            return false;
+        if (defect >= 0 && 2 * edges.size() != 3 * n + defect) {
+            long true_defect = 2 * static_cast<long>(edges.size()) - 3 * static_cast<long>(n);
+            return "has defect " + std::to_string(true_defect) + " (not " + std::to_string(defect) + ")";
         }
-        return true;
+        return "";
+    }
+
+    bool check_valid(size_t defect, string err_msg) const {
+        string err = validity_error(static_cast<int>(defect));
+        if (err.empty()) return true;
+        std::cerr << err_msg << " Graph " << to_g6() << " " << err << "\n";
+        return false;
     }
 
     static bool check_g6_valid(string g6, size_t defect, string err_msg) {
@@ -0,0 +1,146 @@
+#ifndef NAUTY_CANON_HH
+#define NAUTY_CANON_HH
+
+// nauty (dense and sparse) and Traces backends for the canonicalization of Graph, compiled in
+// with -DGGEN_WITH_NAUTY (make NAUTY=1). The parallel build engines call them from several
+// threads, so nauty must be built thread-safe (with TLS, the default of nauty 2.7 and later).
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "Arena.hh"
+#include "nauty.h"
+#include "nausparse.h"
+#include "traces.h"
+
+using namespace std;
+
+enum class NautyMode {
+    Dense,
+    Sparse,
+    Traces
+};
+
+typedef std::function<void(unsigned, const unsigned*)> AutomorphismReport;
+
+// nauty and Traces report automorphisms through plain function pointers; the report callback of
+// the running search is passed through a thread-local.
+struct NautyReportState {
+    const AutomorphismReport* report = nullptr;
+    vector<unsigned> perm;
+};
+
+inline thread_local NautyReportState nauty_report_state;
+
+inline void nauty_forward_automorphism(int n, const int* perm) {
+    auto& st = nauty_report_state;
+    if (st.report == nullptr || !*st.report) return;
+    st.perm.assign(perm, perm + n);
+    (*st.report)(n, st.perm.data());
+}
+
+inline void nauty_automproc(int, int* perm, int*, int, int, int n) {
+    nauty_forward_automorphism(n, perm);
+}
+
+inline void traces_automproc(int, int* perm, int n) {
+    nauty_forward_automorphism(n, perm);
+}
+
+// Canonical labeling and automorphism group generators of the graph on n vertices with the given
+// edges, as for bliss: labels[v] is the canonical label of v (nauty's lab is the inverse), and
+// report(n, perm) receives the generators. Vertex colors, if given, become the initial partition
+// with the cells in increasing color order. labels is only written if getcanon is set.
+// Returns the number of search tree nodes. edges is any container of pair<int, int>; the work
+// arrays are taken from the thread's arena.
+template <typename Edges>
+unsigned long nauty_canonical_labeling(NautyMode mode, int n, const Edges& edges, const vector<unsigned>& colors,
+                                       bool getcanon, unsigned* labels, const AutomorphismReport& report) {
+    if (n == 0) return 0;
+    ArenaVector<int> lab(n), ptn(n, 0), orbits(n);
+    bool colored = !colors.empty();
+    if (colored) {
+        std::iota(lab.begin(), lab.end(), 0);
+        std::stable_sort(lab.begin(), lab.end(), [&](int a, int b) { return colors[a] < colors[b]; });
+        for (int i = 0; i + 1 < n; ++i) {
+            ptn[i] = colors[lab[i]] == colors[lab[i + 1]] ? 1 : 0;
+        }
+    }
+
+    struct ReportGuard {
+        explicit ReportGuard(const AutomorphismReport& r) { nauty_report_state.report = &r; }
+        ~ReportGuard() { nauty_report_state.report = nullptr; }
+    } guard(report);
+
+    unsigned long nodes = 0;
+    if (mode == NautyMode::Dense) {
+        int m = SETWORDSNEEDED(n);
+        nauty_check(WORDSIZE, m, n, NAUTYVERSIONID);
+        ArenaVector<graph> g(static_cast<size_t>(m) * n, 0);
+        ArenaVector<graph> cg(getcanon ? static_cast<size_t>(m) * n : 1);
+        for (const auto& [u, v] : edges) {
+            ADDONEEDGE(g.data(), u, v, m);
+        }
+        DEFAULTOPTIONS_GRAPH(options);
+        options.getcanon = getcanon;
+        options.defaultptn = !colored;
+        options.userautomproc = nauty_automproc;
+        statsblk stats;
+        densenauty(g.data(), lab.data(), ptn.data(), orbits.data(), &options, &stats, m, n,
+                   getcanon ? cg.data() : nullptr);
+        nodes = static_cast<unsigned long>(stats.numnodes);
+    } else {
+        ArenaVector<size_t> v(n);
+        ArenaVector<int> d(n, 0);
+        for (const auto& [a, b] : edges) {
+            d[a]++;
+            d[b]++;
+        }
+        for (int i = 1; i < n; ++i) v[i] = v[i - 1] + d[i - 1];
+        ArenaVector<int> e(2 * edges.size());
+        ArenaVector<size_t> fill(v);
+        for (const auto& [a, b] : edges) {
+            e[fill[a]++] = b;
+            e[fill[b]++] = a;
+        }
+        sparsegraph sg;
+        SG_INIT(sg);
+        sg.nv = n;
+        sg.nde = e.size();
+        sg.v = v.data();
+        sg.vlen = v.size();
+        sg.d = d.data();
+        sg.dlen = d.size();
+        sg.e = e.data();
+        sg.elen = e.size();
+        SG_DECL(cg);
+        if (mode == NautyMode::Sparse) {
+            DEFAULTOPTIONS_SPARSEGRAPH(options);
+            options.getcanon = getcanon;
+            options.defaultptn = !colored;
+            options.userautomproc = nauty_automproc;
+            statsblk stats;
+            sparsenauty(&sg, lab.data(), ptn.data(), orbits.data(), &options, &stats, getcanon ? &cg : nullptr);
+            nodes = static_cast<unsigned long>(stats.numnodes);
+        } else {
+            DEFAULTOPTIONS_TRACES(options);
+            options.getcanon = getcanon;
+            options.defaultptn = !colored;
+            options.userautomproc = traces_automproc;
+            TracesStats stats;
+            Traces(&sg, lab.data(), ptn.data(), orbits.data(), &options, &stats, getcanon ? &cg : nullptr);
+            nodes = static_cast<unsigned long>(stats.numnodes);
+        }
+        SG_FREE(cg);
+    }
+
+    if (getcanon) {
+        for (int i = 0; i < n; ++i) labels[lab[i]] = i;
+    }
+    return nodes;
+}
+
+#endif // NAUTY_CANON_HH
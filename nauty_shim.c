@@ -1,29 +1,338 @@
-#define MAXN 128
-#define MAXM ((MAXN + WORDSIZE - 1) / WORDSIZE)
+#define MAXN 0
+// Dynamic sizes (MAXN 0): the shim works for any number of vertices.
 
-#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "nauty.h"
-#include "gtools.h"  // <-- Needed for stringtograph and writeline
+#include "nausparse.h"
 
-int canonicalize_g6(const char *input_g6, char *output_g6) {
-    graph g[MAXN * MAXM], cg[MAXN * MAXM];
-    int lab[MAXN], ptn[MAXN], orbits[MAXN];
-    static DEFAULTOPTIONS_GRAPH(options);
+// Reentrant C interface to sparsenauty.
+//
+// Nothing here is static or shared between threads: options and statistics live on the stack
+// of each call, and the vertex/edge workspace is thread-local and grows as needed. nauty itself
+// must be built thread-safe (with TLS, the default of nauty 2.7 and later).
+//
+// Labelings follow the bliss convention: labels[v] is the canonical label of vertex v (the
+// inverse of nauty's lab). Errors are reported by the return value, never printed.
+
+enum {
+    NAUTY_SHIM_OK = 0,
+    NAUTY_SHIM_EINVAL = -1,   // invalid graph or arguments
+    NAUTY_SHIM_ENOMEM = -2,
+    NAUTY_SHIM_ENAUTY = -3    // nauty reported an error
+};
+
+typedef struct {
+    int *lab, *ptn, *orbits, *deg, *adj;
+    size_t *off;
+    size_t cap_n, cap_e;
+    // generators of the running search
+    int *gens;
+    size_t max_gens, num_gens;
+} nauty_shim_workspace;
+
+static _Thread_local nauty_shim_workspace shim_ws;
+
+static int grow(void **p, size_t count, size_t size) {
+    void *q = realloc(*p, count * size);
+    if (q == NULL) return 0;
+    *p = q;
+    return 1;
+}
+
+static int reserve_workspace(size_t n, size_t ne) {
+    nauty_shim_workspace *ws = &shim_ws;
+    if (n > ws->cap_n) {
+        if (!grow((void **)&ws->lab, n, sizeof(int)) || !grow((void **)&ws->ptn, n, sizeof(int)) ||
+            !grow((void **)&ws->orbits, n, sizeof(int)) || !grow((void **)&ws->deg, n, sizeof(int)) ||
+            !grow((void **)&ws->off, n, sizeof(size_t))) {
+            return 0;
+        }
+        ws->cap_n = n;
+    }
+    if (2 * ne > ws->cap_e) {
+        if (!grow((void **)&ws->adj, 2 * ne, sizeof(int))) return 0;
+        ws->cap_e = 2 * ne;
+    }
+    return 1;
+}
+
+// Free the workspace of the calling thread; it is reallocated by the next call.
+void nauty_shim_thread_cleanup(void) {
+    nauty_shim_workspace *ws = &shim_ws;
+    free(ws->lab);
+    free(ws->ptn);
+    free(ws->orbits);
+    free(ws->deg);
+    free(ws->adj);
+    free(ws->off);
+    memset(ws, 0, sizeof(*ws));
+}
+
+static void collect_generator(int count, int *perm, int *orbits, int numorbits, int stabvertex, int n) {
+    nauty_shim_workspace *ws = &shim_ws;
+    (void)count;
+    (void)orbits;
+    (void)numorbits;
+    (void)stabvertex;
+    if (ws->gens != NULL && ws->num_gens < ws->max_gens) {
+        memcpy(ws->gens + ws->num_gens * (size_t)n, perm, (size_t)n * sizeof(int));
+    }
+    ws->num_gens++;
+}
+
+// Canonical labeling and automorphism group of a graph with n vertices and num_edges edges
+// (pairs edges[2i], edges[2i+1], no loops).
+//   colors        optional vertex colors (NULL: uncolored); the cells of the initial partition
+//                 are ordered by increasing color, so canonical labels respect the color order
+//   out_labels    optional, n ints: canonical label of each vertex
+//   out_gens      optional, max_gens * n ints: the first max_gens generators of the group
+//   out_num_gens  optional: the number of generators (may exceed max_gens)
+//   out_grpsize1, out_grpsize2  optional: group size = grpsize1 * 10^grpsize2
+// Returns NAUTY_SHIM_OK or a negative error code.
+int nauty_canon_sparse(int n, const int *edges, size_t num_edges, const int *colors,
+                       int *out_labels, int *out_gens, size_t max_gens, size_t *out_num_gens,
+                       double *out_grpsize1, int *out_grpsize2) {
+    nauty_shim_workspace *ws;
+    sparsegraph sg;
     statsblk stats;
-    int n, m = MAXM;
+    size_t i;
+    int v;
+    DEFAULTOPTIONS_SPARSEGRAPH(options);
+    SG_DECL(canong);
+
+    if (n < 0 || (num_edges > 0 && edges == NULL)) return NAUTY_SHIM_EINVAL;
+    if (n == 0) {
+        if (out_num_gens) *out_num_gens = 0;
+        if (out_grpsize1) *out_grpsize1 = 1.0;
+        if (out_grpsize2) *out_grpsize2 = 0;
+        return NAUTY_SHIM_OK;
+    }
+    if (!reserve_workspace((size_t)n, num_edges)) return NAUTY_SHIM_ENOMEM;
+    ws = &shim_ws;
+
+    // adjacency in CSR form
+    memset(ws->deg, 0, (size_t)n * sizeof(int));
+    for (i = 0; i < num_edges; ++i) {
+        int a = edges[2 * i], b = edges[2 * i + 1];
+        if (a < 0 || b < 0 || a >= n || b >= n || a == b) return NAUTY_SHIM_EINVAL;
+        ws->deg[a]++;
+        ws->deg[b]++;
+    }
+    ws->off[0] = 0;
+    for (v = 1; v < n; ++v) ws->off[v] = ws->off[v - 1] + ws->deg[v - 1];
+    for (v = 0; v < n; ++v) ws->orbits[v] = 0;  // fill position per vertex
+    for (i = 0; i < num_edges; ++i) {
+        int a = edges[2 * i], b = edges[2 * i + 1];
+        ws->adj[ws->off[a] + ws->orbits[a]++] = b;
+        ws->adj[ws->off[b] + ws->orbits[b]++] = a;
+    }
+    SG_INIT(sg);
+    sg.nv = n;
+    sg.nde = 2 * num_edges;
+    sg.v = ws->off;
+    sg.vlen = (size_t)n;
+    sg.d = ws->deg;
+    sg.dlen = (size_t)n;
+    sg.e = ws->adj;
+    sg.elen = 2 * num_edges;
+
+    // initial partition: vertices sorted by color (insertion sort keeps it allocation free)
+    for (v = 0; v < n; ++v) ws->lab[v] = v;
+    if (colors != NULL) {
+        for (v = 1; v < n; ++v) {
+            int x = ws->lab[v], j = v;
+            while (j > 0 && colors[ws->lab[j - 1]] > colors[x]) {
+                ws->lab[j] = ws->lab[j - 1];
+                --j;
+            }
+            ws->lab[j] = x;
+        }
+        for (v = 0; v < n; ++v) {
+            ws->ptn[v] = (v + 1 < n && colors[ws->lab[v]] == colors[ws->lab[v + 1]]) ? 1 : 0;
+        }
+    }
+
+    ws->gens = out_gens;
+    ws->max_gens = out_gens ? max_gens : 0;
+    ws->num_gens = 0;
+    options.getcanon = out_labels != NULL;
+    options.defaultptn = colors == NULL;
+    options.userautomproc = collect_generator;
+    sparsenauty(&sg, ws->lab, ws->ptn, ws->orbits, &options, &stats, out_labels ? &canong : NULL);
+    SG_FREE(canong);
+    ws->gens = NULL;
+    if (stats.errstatus != 0) return NAUTY_SHIM_ENAUTY;
 
-    // stringtograph returns NULL on error
-    if (stringtograph((char*)input_g6, g, m, &n) == NULL) {
-        fprintf(stderr, "Invalid g6 input: %s\n", input_g6);
-        return 1;
+    if (out_labels) {
+        for (v = 0; v < n; ++v) out_labels[ws->lab[v]] = v;
     }
+    if (out_num_gens) *out_num_gens = ws->num_gens;
+    if (out_grpsize1) *out_grpsize1 = stats.grpsize1;
+    if (out_grpsize2) *out_grpsize2 = stats.grpsize2;
+    return NAUTY_SHIM_OK;
+}
 
-    options.getcanon = TRUE;
-    densenauty(g, lab, ptn, orbits, &options, &stats, m, n, cg);
+typedef struct {
+    size_t num_graphs;
+    const size_t *vertex_offsets, *edge_offsets;
+    const int *edges, *colors;
+    int *out_labels;
+    double *out_grpsize1;
+    int *out_grpsize2;
+    atomic_size_t next;
+    atomic_size_t first_error;  // 1 + index of the first failed graph, 0 if none
+} batch_job;
 
-    // write canonical graph to output_g6 (should be large enough!)
-    writeline(cg, output_g6, m, n);
+static void *batch_worker(void *arg) {
+    batch_job *job = (batch_job *)arg;
+    size_t g;
+    while ((g = atomic_fetch_add(&job->next, 1)) < job->num_graphs) {
+        size_t v0 = job->vertex_offsets[g];
+        size_t e0 = job->edge_offsets[g];
+        int rc = nauty_canon_sparse((int)(job->vertex_offsets[g + 1] - v0), job->edges + 2 * e0,
+                                    job->edge_offsets[g + 1] - e0, job->colors ? job->colors + v0 : NULL,
+                                    job->out_labels + v0, NULL, 0, NULL,
+                                    job->out_grpsize1 ? job->out_grpsize1 + g : NULL,
+                                    job->out_grpsize2 ? job->out_grpsize2 + g : NULL);
+        if (rc != NAUTY_SHIM_OK) {
+            size_t expected = 0;
+            size_t err = g + 1;
+            // keep the smallest failing index
+            while ((expected == 0 || err < expected) &&
+                   !atomic_compare_exchange_weak(&job->first_error, &expected, err)) {
+            }
+        }
+    }
+    return NULL;
+}
+
+// Thread started by nauty_canon_sparse_batch: its workspace and nauty's thread-local dynamic
+// storage die with it, so free them before it exits.
+static void *spawned_batch_worker(void *arg) {
+    batch_worker(arg);
+    nauty_shim_thread_cleanup();
+    nausparse_freedyn();
+    nautil_freedyn();
+    nauty_freedyn();
+    return NULL;
+}
+
+// Canonical labelings of a batch of graphs, in the flat layout of canonicalize_graph_batch:
+// graph g has the vertices vertex_offsets[g] .. vertex_offsets[g+1]-1 (numbered from 0 within the
+// graph) and the edges edge_offsets[g] .. edge_offsets[g+1]-1 of the pair array `edges`.
+// colors (optional) and out_labels are indexed like the vertices; out_grpsize1/2 (optional)
+// per graph. num_threads = 0 uses all cores. Returns 0, or 1 + the index of the first graph that
+// failed.
+size_t nauty_canon_sparse_batch(size_t num_graphs, const size_t *vertex_offsets, const size_t *edge_offsets,
+                                const int *edges, const int *colors, unsigned num_threads,
+                                int *out_labels, double *out_grpsize1, int *out_grpsize2) {
+    batch_job job;
+    pthread_t *threads;
+    unsigned t, started = 0;
+
+    job.num_graphs = num_graphs;
+    job.vertex_offsets = vertex_offsets;
+    job.edge_offsets = edge_offsets;
+    job.edges = edges;
+    job.colors = colors;
+    job.out_labels = out_labels;
+    job.out_grpsize1 = out_grpsize1;
+    job.out_grpsize2 = out_grpsize2;
+    atomic_init(&job.next, 0);
+    atomic_init(&job.first_error, 0);
+
+    if (num_threads == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = ncpu > 0 ? (unsigned)ncpu : 1;
+    }
+    if (num_threads > num_graphs) num_threads = num_graphs > 0 ? (unsigned)num_graphs : 1;
+
+    threads = num_threads > 1 ? malloc((num_threads - 1) * sizeof(pthread_t)) : NULL;
+    for (t = 1; t < num_threads && threads != NULL; ++t) {
+        if (pthread_create(&threads[started], NULL, spawned_batch_worker, &job) != 0) break;
+        ++started;
+    }
+    batch_worker(&job);
+    for (t = 0; t < started; ++t) pthread_join(threads[t], NULL);
+    free(threads);
+    return atomic_load(&job.first_error);
+}
+
+#define G6_MAX_N 128
+
+// Canonical form of a graph6 string (n <= G6_MAX_N), written to output_g6 (output_size bytes
+// including the terminating 0). Returns 0 on success, 1 for invalid input, 2 if the output does
+// not fit.
+int canonicalize_g6_r(const char *input_g6, char *output_g6, size_t output_size) {
+    int n, i, j, k, rc;
+    size_t len, header, bytes, num_edges = 0;
+    int edges[G6_MAX_N * (G6_MAX_N - 1)];
+    int labels[G6_MAX_N];
+    unsigned char bits[G6_MAX_N * (G6_MAX_N - 1) / 2 / 6 + 1];
+
+    if (input_g6 == NULL || output_g6 == NULL) return 1;
+    len = strlen(input_g6);
+    while (len > 0 && (input_g6[len - 1] == '\n' || input_g6[len - 1] == '\r')) --len;
+    if (len == 0) return 1;
+    // n < 63 in one byte, otherwise '~' followed by 18 bits
+    if (input_g6[0] != 126) {
+        n = input_g6[0] - 63;
+        header = 1;
+    } else {
+        if (len < 4 || input_g6[1] == 126) return 1;
+        n = 0;
+        for (i = 1; i < 4; ++i) n = (n << 6) | (input_g6[i] - 63);
+        header = 4;
+    }
+    if (n < 0 || n > G6_MAX_N) return 1;
+    bytes = ((size_t)n * (n - 1) / 2 + 5) / 6;
+    if (len != header + bytes) return 1;
+    for (i = 0; i < (int)(header + bytes); ++i) {
+        if (input_g6[i] < 63 || input_g6[i] > 126) return 1;
+    }
+    // upper triangle column by column, 6 bits per character, high bit first
+    k = 0;
+    for (j = 1; j < n; ++j) {
+        for (i = 0; i < j; ++i, ++k) {
+            if (((input_g6[header + k / 6] - 63) >> (5 - k % 6)) & 1) {
+                edges[2 * num_edges] = i;
+                edges[2 * num_edges + 1] = j;
+                ++num_edges;
+            }
+        }
+    }
+
+    rc = nauty_canon_sparse(n, edges, num_edges, NULL, labels, NULL, 0, NULL, NULL, NULL);
+    if (rc != NAUTY_SHIM_OK) return 1;
+
+    if (output_size < header + bytes + 1) return 2;
+    memset(bits, 0, bytes);
+    for (k = 0; k < (int)num_edges; ++k) {
+        int a = labels[edges[2 * k]], b = labels[edges[2 * k + 1]];
+        int lo = a < b ? a : b, hi = a < b ? b : a;
+        int pos = hi * (hi - 1) / 2 + lo;
+        bits[pos / 6] |= (unsigned char)(1 << (5 - pos % 6));
+    }
+    if (header == 1) {
+        output_g6[0] = (char)(63 + n);
+    } else {
+        output_g6[0] = 126;
+        output_g6[1] = (char)(63 + ((n >> 12) & 63));
+        output_g6[2] = (char)(63 + ((n >> 6) & 63));
+        output_g6[3] = (char)(63 + (n & 63));
+    }
+    for (i = 0; i < (int)bytes; ++i) output_g6[header + i] = (char)(63 + bits[i]);
+    output_g6[header + bytes] = '\0';
     return 0;
 }
+
+// Previous interface, kept for existing callers: output_g6 must be large enough for the result.
+int canonicalize_g6(const char *input_g6, char *output_g6) {
+    return canonicalize_g6_r(input_g6, output_g6, (size_t)-1);
+}
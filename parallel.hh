@@ -0,0 +1,287 @@
+#ifndef PARALLEL_HH
+#define PARALLEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Number of worker threads used by parallel_for. 0 means std::thread::hardware_concurrency().
+inline unsigned parallel_num_threads_setting = 0;
+
+inline unsigned parallel_num_threads() {
+    if (parallel_num_threads_setting > 0) return parallel_num_threads_setting;
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+// Scheduling counters of one worker of parallel_for, summed over all calls.
+struct ParallelWorkerStats {
+    uint64_t items = 0;
+    uint64_t chunks = 0;
+    uint64_t steals = 0;            // ranges taken from other workers
+    double busy_seconds = 0;        // running the body
+    double idle_seconds = 0;        // scheduling, stealing, or done while other workers still ran
+};
+
+inline std::mutex parallel_stats_mtx;
+inline vector<ParallelWorkerStats> parallel_stats_totals;
+
+inline void add_parallel_worker_stats(const vector<ParallelWorkerStats>& stats) {
+    std::lock_guard<std::mutex> lock(parallel_stats_mtx);
+    if (parallel_stats_totals.size() < stats.size()) parallel_stats_totals.resize(stats.size());
+    for (size_t t = 0; t < stats.size(); ++t) {
+        auto& total = parallel_stats_totals[t];
+        total.items += stats[t].items;
+        total.chunks += stats[t].chunks;
+        total.steals += stats[t].steals;
+        total.busy_seconds += stats[t].busy_seconds;
+        total.idle_seconds += stats[t].idle_seconds;
+    }
+}
+
+inline vector<ParallelWorkerStats> parallel_worker_stats() {
+    std::lock_guard<std::mutex> lock(parallel_stats_mtx);
+    return parallel_stats_totals;
+}
+
+inline void print_parallel_worker_stats(std::ostream& out) {
+    out << "worker        items   chunks   steals     busy s     idle s   busy %\n";
+    auto stats = parallel_worker_stats();
+    for (size_t t = 0; t < stats.size(); ++t) {
+        const auto& s = stats[t];
+        double total = s.busy_seconds + s.idle_seconds;
+        char line[128];
+        snprintf(line, sizeof(line), "%6zu %12llu %8llu %8llu %10.3f %10.3f %7.1f%%\n", t, (unsigned long long)s.items,
+                 (unsigned long long)s.chunks, (unsigned long long)s.steals, s.busy_seconds, s.idle_seconds,
+                 total > 0 ? 100 * s.busy_seconds / total : 0.0);
+        out << line;
+    }
+}
+
+// Worker threads of parallel_for, started on first use and kept until exit, so that the many
+// short loops of a build (rank rounds, dense columns, file splits) don't start and join threads
+// each time. Worker t always runs as thread_id t.
+class ParallelPool {
+    public:
+        static ParallelPool& instance() {
+            static ParallelPool pool;
+            return pool;
+        }
+
+        ~ParallelPool() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                shutdown = true;
+            }
+            wake.notify_all();
+            for (auto& t : threads) t.join();
+        }
+
+        ParallelPool(const ParallelPool&) = delete;
+        ParallelPool& operator=(const ParallelPool&) = delete;
+
+        // Exclusive use of the workers for the calls of run() while it lives; not held if another
+        // lease is, e.g. for a parallel_for nested in the body of another.
+        class Lease {
+            public:
+                explicit Lease(bool want) {
+                    bool expected = false;
+                    held = want && instance().leased.compare_exchange_strong(expected, true);
+                }
+
+                ~Lease() {
+                    if (held) instance().leased.store(false);
+                }
+
+                Lease(const Lease&) = delete;
+                Lease& operator=(const Lease&) = delete;
+
+                bool held;
+        };
+
+        // Run job(t) for t in [1, k) on the workers, starting missing ones, and job(0) on the
+        // calling thread, which holds the lease; returns when all are done. job must not throw.
+        template <typename F>
+        void run(unsigned k, F& job) {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (threads.size() + 1 < k) {
+                unsigned t = threads.size() + 1;
+                threads.emplace_back([this, t, seen = generation] { work(t, seen); });
+            }
+            task = [&job](unsigned t) { job(t); };
+            active = k;
+            pending = k - 1;
+            ++generation;
+            lock.unlock();
+            wake.notify_all();
+            job(0);
+            lock.lock();
+            done.wait(lock, [&] { return pending == 0; });
+            task = nullptr;
+        }
+
+    private:
+        ParallelPool() = default;
+
+        std::atomic<bool> leased{false};
+        std::mutex mtx;
+        std::condition_variable wake;
+        std::condition_variable done;
+        vector<std::thread> threads;
+        std::function<void(unsigned)> task;
+        unsigned active = 0;            // workers [1, active) take part in the current job
+        unsigned pending = 0;           // of them, the ones still running it
+        uint64_t generation = 0;        // number of jobs started
+        bool shutdown = false;
+
+        void work(unsigned t, uint64_t seen) {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (true) {
+                wake.wait(lock, [&] { return shutdown || generation != seen; });
+                if (shutdown) return;
+                seen = generation;
+                if (t >= active) continue;
+                lock.unlock();
+                task(t);
+                lock.lock();
+                if (--pending == 0) done.notify_one();
+            }
+        }
+};
+
+// Run body(i, thread_id) for all i in [0, n) on parallel_num_threads() threads.
+// Work stealing: every worker starts with an equal share of the indices and takes chunks of
+// 1/chunk_divisor of what is left of it, so chunks shrink as its range runs out. A worker whose
+// range is empty steals the upper half of the largest remaining range. Items whose cost varies by
+// orders of magnitude (e.g. canonical forms of highly symmetric graphs) thus keep all workers busy
+// until the end. thread_id is in [0, parallel_num_threads()) and can index per-thread
+// accumulators. The first exception thrown by a worker is rethrown on the calling thread.
+// max_threads > 0 overrides parallel_num_threads() for this call. The workers are those of
+// ParallelPool; a call made while another one runs on the pool, e.g. from inside a body, runs
+// serially on the calling thread. Busy and idle time per worker are added to
+// parallel_worker_stats().
+template <typename F>
+void parallel_for(size_t n, F&& body, unsigned max_threads = 0) {
+    using clock = std::chrono::steady_clock;
+    auto seconds = [](clock::duration d) { return std::chrono::duration<double>(d).count(); };
+    unsigned num_threads = std::min<size_t>(max_threads > 0 ? max_threads : parallel_num_threads(), std::max<size_t>(n, 1));
+    ParallelPool::Lease lease(num_threads > 1);
+    if (!lease.held) num_threads = 1;
+    vector<ParallelWorkerStats> stats(num_threads);
+    if (num_threads <= 1) {
+        auto start = clock::now();
+        for (size_t i = 0; i < n; ++i) body(i, 0u);
+        stats[0].items = n;
+        stats[0].chunks = n > 0 ? 1 : 0;
+        stats[0].busy_seconds = seconds(clock::now() - start);
+        add_parallel_worker_stats(stats);
+        return;
+    }
+    constexpr size_t chunk_divisor = 8;
+
+    // [begin, end) of the indices left to a worker
+    struct alignas(64) WorkRange {
+        std::mutex mtx;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+    vector<WorkRange> ranges(num_threads);
+    for (unsigned t = 0; t < num_threads; ++t) {
+        ranges[t].begin = n * t / num_threads;
+        ranges[t].end = n * (t + 1) / num_threads;
+    }
+    std::atomic<bool> stop{false};
+    std::exception_ptr error;
+    std::mutex error_mtx;
+
+    // next chunk of the own range
+    auto take = [&](unsigned tid, size_t& begin, size_t& end) {
+        WorkRange& r = ranges[tid];
+        std::lock_guard<std::mutex> lock(r.mtx);
+        size_t left = r.end - r.begin;
+        if (left == 0) return false;
+        begin = r.begin;
+        end = begin + std::max<size_t>(1, left / chunk_divisor);
+        r.begin = end;
+        return true;
+    };
+    // move the upper half of the largest other range to the own range
+    auto steal = [&](unsigned tid) {
+        while (!stop.load(std::memory_order_relaxed)) {
+            unsigned victim = tid;
+            size_t most = 0;
+            for (unsigned k = 1; k < num_threads; ++k) {
+                unsigned t = (tid + k) % num_threads;
+                std::lock_guard<std::mutex> lock(ranges[t].mtx);
+                size_t left = ranges[t].end - ranges[t].begin;
+                if (left > most) {
+                    most = left;
+                    victim = t;
+                }
+            }
+            if (most == 0) return false;
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(ranges[victim].mtx);
+                size_t left = ranges[victim].end - ranges[victim].begin;
+                // taken in the meantime, look again
+                if (left == 0) continue;
+                end = ranges[victim].end;
+                begin = end - (left + 1) / 2;
+                ranges[victim].end = begin;
+            }
+            std::lock_guard<std::mutex> lock(ranges[tid].mtx);
+            ranges[tid].begin = begin;
+            ranges[tid].end = end;
+            return true;
+        }
+        return false;
+    };
+
+    auto start = clock::now();
+    auto worker = [&](unsigned tid) {
+        ParallelWorkerStats& st = stats[tid];
+        clock::duration busy{};
+        try {
+            while (!stop.load(std::memory_order_relaxed)) {
+                size_t begin, end;
+                if (!take(tid, begin, end)) {
+                    if (!steal(tid)) break;
+                    ++st.steals;
+                    continue;
+                }
+                auto chunk_start = clock::now();
+                for (size_t i = begin; i < end; ++i) body(i, tid);
+                busy += clock::now() - chunk_start;
+                st.items += end - begin;
+                ++st.chunks;
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mtx);
+            if (!error) error = std::current_exception();
+            // make the other workers stop
+            stop.store(true, std::memory_order_relaxed);
+        }
+        st.busy_seconds = seconds(busy);
+    };
+
+    ParallelPool::instance().run(num_threads, worker);
+    double wall = seconds(clock::now() - start);
+    for (auto& st : stats) st.idle_seconds = std::max(0.0, wall - st.busy_seconds);
+    add_parallel_worker_stats(stats);
+    if (error) std::rethrow_exception(error);
+}
+
+#endif // PARALLEL_HH
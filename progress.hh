@@ -0,0 +1,140 @@
+#ifndef PROGRESS_HH
+#define PROGRESS_HH
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+// Progress and ETA reporting for long-running loops.
+// Worker threads only bump a relaxed atomic counter; a background thread wakes up on a timer
+// and prints position, rate and ETA. On a terminal the line is redrawn in place (like the
+// indicatif bars of the Rust pipeline), otherwise a plain log line is printed per interval.
+class ProgressReporter {
+    public:
+        // Global switch, e.g. for --no-progress.
+        static inline bool enabled = true;
+
+        ProgressReporter(const string& label_, size_t total_)
+            : label(label_), total(total_), is_tty(isatty(fileno(stdout))) {
+            start_time = std::chrono::steady_clock::now();
+            // log files do not need frequent updates
+            interval = std::chrono::milliseconds(is_tty ? 500 : 30000);
+            if (enabled) {
+                worker = std::thread([this]() { run(); });
+            }
+        }
+
+        ~ProgressReporter() {
+            finish();
+        }
+
+        ProgressReporter(const ProgressReporter&) = delete;
+        ProgressReporter& operator=(const ProgressReporter&) = delete;
+
+        // Hot path: safe to call concurrently from any number of threads.
+        void inc(size_t n = 1) {
+            count.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        // For loops whose length is only known after some setup work.
+        void set_total(size_t total_) {
+            total.store(total_, std::memory_order_relaxed);
+        }
+
+        size_t position() const {
+            return count.load(std::memory_order_relaxed);
+        }
+
+        // Stop the reporter thread and print the final line. Idempotent.
+        void finish() {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (done) return;
+                done = true;
+            }
+            cv.notify_all();
+            if (worker.joinable()) {
+                worker.join();
+                print_line(true);
+            }
+        }
+
+    private:
+        // keep the counter on its own cache line, away from the fields the reporter thread reads
+        alignas(64) std::atomic<size_t> count{0};
+        alignas(64) string label;
+        std::atomic<size_t> total;
+        bool is_tty;
+        std::chrono::steady_clock::time_point start_time;
+        std::chrono::milliseconds interval;
+        std::thread worker;
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool done = false;
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mtx);
+            while (!done) {
+                cv.wait_for(lock, interval, [this]() { return done; });
+                if (!done) print_line(false);
+            }
+        }
+
+        static string format_duration(double seconds) {
+            if (seconds < 0 || seconds > 1e9) return "--:--:--";
+            auto s = static_cast<uint64_t>(seconds);
+            char buf[32];
+            snprintf(buf, sizeof(buf), "%02llu:%02llu:%02llu",
+                     (unsigned long long)(s / 3600), (unsigned long long)((s / 60) % 60),
+                     (unsigned long long)(s % 60));
+            return buf;
+        }
+
+        static string format_rate(double rate) {
+            char buf[32];
+            if (rate >= 1e6) snprintf(buf, sizeof(buf), "%.2fM/s", rate / 1e6);
+            else if (rate >= 1e3) snprintf(buf, sizeof(buf), "%.2fk/s", rate / 1e3);
+            else snprintf(buf, sizeof(buf), "%.1f/s", rate);
+            return buf;
+        }
+
+        void print_line(bool final_line) {
+            size_t pos = position();
+            size_t total = this->total.load(std::memory_order_relaxed);
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+            double rate = elapsed > 0 ? pos / elapsed : 0.0;
+            double frac = total > 0 ? static_cast<double>(pos) / total : 1.0;
+            double eta = (rate > 0 && pos < total) ? (total - pos) / rate : (pos >= total ? 0.0 : -1.0);
+
+            std::ostringstream out;
+            if (is_tty) {
+                const int width = 40;
+                int filled = static_cast<int>(frac * width);
+                if (filled > width) filled = width;
+                out << "\r[" << format_duration(elapsed) << "] " << label << " [";
+                for (int i = 0; i < width; ++i) {
+                    out << (i < filled ? '#' : (i == filled ? '>' : '-'));
+                }
+                out << "] " << pos << "/" << total << " (" << static_cast<int>(frac * 100) << "%) "
+                    << format_rate(rate) << " ETA: " << format_duration(eta);
+                if (final_line) out << "\n";
+            } else {
+                out << "[" << format_duration(elapsed) << "] " << label << ": " << pos << "/" << total
+                    << " (" << static_cast<int>(frac * 100) << "%) " << format_rate(rate)
+                    << (final_line ? " done" : " ETA: " + format_duration(eta)) << "\n";
+            }
+            std::cout << out.str() << std::flush;
+        }
+};
+
+#endif // PROGRESS_HH
@@ -450,6 +450,72 @@ pub fn canonicalize_and_dedup_g6(
     Ok(canonical_set)
 }
 
+/// Canonicalize and deduplicate all g6 strings with a single `blisscli -g --unique` process,
+/// which canonicalizes on all cores itself, instead of one labelg process per batch.
+pub fn canonicalize_and_dedup_g6_stream(
+    g6_list: &Vec<String>,
+    blisscli_path: &str,
+) -> Result<HashSet<String>, Box<dyn Error>> {
+    let mut child = Command::new(blisscli_path)
+        .arg("-g")
+        .arg("--unique")
+        .stdin(Stdio::piped())
+        .stdout(Stdio::piped())
+        .stderr(Stdio::inherit())
+        .spawn()?;
+
+    let mut stdin = child.stdin.take().ok_or("Failed to open stdin")?;
+    let input = g6_list.to_owned();
+    let writer_handle = thread::spawn(move || {
+        let mut writer = std::io::BufWriter::with_capacity(1 << 20, &mut stdin);
+        for g6 in input {
+            // We ignore errors here; the read side handles subprocess failure
+            let _ = writeln!(writer, "{}", g6);
+        }
+        let _ = writer.flush();
+        drop(writer);
+        drop(stdin);
+    });
+
+    let stdout = child.stdout.take().ok_or("Failed to open stdout")?;
+    let reader = BufReader::with_capacity(1 << 20, stdout);
+    let mut canonicals = HashSet::new();
+    for line in reader.lines() {
+        canonicals.insert(line?);
+    }
+
+    writer_handle.join().expect("Writer thread panicked");
+
+    let status = child.wait()?;
+    if !status.success() {
+        return Err(format!("blisscli failed with exit code {:?}", status.code()).into());
+    }
+
+    Ok(canonicals)
+}
+
+/// External tool used to canonicalize generated graphs for deduplication. The two produce
+/// different canonical forms: graph files written with blisscli differ from the labelg ones, and
+/// no longer match the geng references of `compare_file_to_ref` (which are in nauty form).
+#[derive(Clone, Copy)]
+pub enum Canonicalizer<'a> {
+    /// nauty `labelg` at the given path, one process per batch of `BATCH_SIZE` graphs
+    Labelg(&'a str),
+    /// a single `blisscli -g --unique` process at the given path (`make cli`)
+    Blisscli(&'a str),
+}
+
+/// Canonicalize g6 strings with `canon` and deduplicate the canonical results.
+pub fn canonicalize_and_dedup_with(
+    g6_list: &Vec<String>,
+    canon: Canonicalizer,
+) -> Result<HashSet<String>, Box<dyn Error>> {
+    match canon {
+        Canonicalizer::Labelg(path) => canonicalize_and_dedup_g6(g6_list, path),
+        Canonicalizer::Blisscli(path) => canonicalize_and_dedup_g6_stream(g6_list, path),
+    }
+}
+
 /// Helper to run one batch of g6 strings through labelg and collect output.
 fn run_labelg_batch(
     batch: &[String],
@@ -510,7 +576,7 @@ pub fn is_satisfiable(g: usize, d: usize) -> bool {
     true
 }
 
-pub fn generate_graphs(g : usize, d : usize, labelg_path: &str) -> Result<(), Box<dyn std::error::Error>> {
+pub fn generate_graphs(g : usize, d : usize, canon: Canonicalizer) -> Result<(), Box<dyn std::error::Error>> {
     // d is the defect
     println!("Generating graphs with genus {} and defect {}...", g, d);
 
@@ -584,7 +650,7 @@ pub fn generate_graphs(g : usize, d : usize, labelg_path: &str) -> Result<(), Bo
 
         println!("{} graphs generated, deduplicating...", g6list.len());
         let start = Instant::now();
-        let g6_canon: HashSet<String> = canonicalize_and_dedup_g6(&g6list, labelg_path)?;
+        let g6_canon: HashSet<String> = canonicalize_and_dedup_with(&g6list, canon)?;
         println!("Deduplication took {:.2?}, {} unique graphs remaining.", start.elapsed(), g6_canon.len());
         let g6_vec: Vec<String> = g6_canon.into_iter().collect();
         println!("Saving {} graphs to file {}", g6_vec.len(), filename);
@@ -734,7 +800,7 @@ pub fn generate_graphs(g : usize, d : usize, labelg_path: &str) -> Result<(), Bo
 
         println!("{} graphs generated, deduplicating...", g6list.len());
         let start = Instant::now();
-        let g6_canon: HashSet<String> = canonicalize_and_dedup_g6(&g6list, labelg_path)?;
+        let g6_canon: HashSet<String> = canonicalize_and_dedup_with(&g6list, canon)?;
         println!("Deduplication took {:.2?}, {} unique graphs remaining.", start.elapsed(), g6_canon.len());
 
         let g6_vec: Vec<String> = g6_canon.into_iter().collect();
@@ -857,6 +923,26 @@ mod tests {
         }
     }
 
+    #[test]
+    fn test_canonicalize_and_dedup_g6_stream() {
+        // Same graphs as above, through one blisscli process (built by `make cli`)
+        let g6_graphs = vec![
+            "D??".to_string(),
+            "D_@".to_string(),
+            "D`?".to_string(),
+            "D?@".to_string(),
+        ];
+
+        let canon_set = canonicalize_and_dedup_g6_stream(&g6_graphs, "./blisscli")
+            .unwrap_or_else(|e| panic!("canonicalize_and_dedup_g6_stream failed: {}", e));
+        assert_eq!(canon_set.len(), 3, "Expected 3 canonical forms, got {:?}", canon_set);
+
+        // the canonical forms must be fixed points of the canonicalization
+        let again: Vec<String> = canon_set.iter().cloned().collect();
+        let canon_again = canonicalize_and_dedup_g6_stream(&again, "./blisscli").unwrap();
+        assert_eq!(canon_again, canon_set);
+    }
+
     #[test]
     fn test_tetrahedron_equals_tetrastring_1() {
         let g1 = Graph::tetrahedron_graph();
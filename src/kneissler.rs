@@ -143,25 +143,25 @@ pub fn kneissler_filename(nloops: usize, ntype: usize) -> String {
     format!("data/kneissler_{}_{}.g6", nloops, ntype)
 }
 
-pub fn compute_all_kneissler_graphs(nloops : usize, ntype: usize) {
+pub fn compute_all_kneissler_graphs(nloops : usize, ntype: usize, canon: Canonicalizer) {
     let fname = kneissler_filename(nloops, ntype);
     let k = nloops - 1;
     if ntype == 0 {
         let gs = all_barrel_graphs(k).map(|g| g.to_g6()).collect::<Vec<_>>();
-        let gs2 = canonicalize_and_dedup_g6(&gs, "labelg").unwrap().into_iter().collect::<Vec<_>>();
+        let gs2 = canonicalize_and_dedup_with(&gs, canon).unwrap().into_iter().collect::<Vec<_>>();
         Graph::save_to_file(&gs2, &fname).unwrap();
     } else if ntype == 1 {
         let gs = all_tbarrel_graphs(k)
             .chain(all_xtbarrel_graphs(k))
             .map(|g| g.to_g6()).collect::<Vec<_>>();
-        let gs2 = canonicalize_and_dedup_g6(&gs, "labelg").unwrap().into_iter().collect::<Vec<_>>();
+        let gs2 = canonicalize_and_dedup_with(&gs, canon).unwrap().into_iter().collect::<Vec<_>>();
         Graph::save_to_file(&gs2, &fname).unwrap();
     } else if ntype == 2 {
         let gs = all_barrel_graphs(k)
             .chain(all_triangle_graphs(k))
             .chain(all_hgraph_graphs(k))
             .map(|g| g.to_g6()).collect::<Vec<_>>();
-        let gs2 = canonicalize_and_dedup_g6(&gs, "labelg").unwrap().into_iter().collect::<Vec<_>>();
+        let gs2 = canonicalize_and_dedup_with(&gs, canon).unwrap().into_iter().collect::<Vec<_>>();
         Graph::save_to_file(&gs2, &fname).unwrap();
     } else if ntype == 3 {
         // load the type 0 and type 2 graphs from file
@@ -82,6 +82,15 @@ fn main() {
                 .required(false)
                 .default_value("labelg")
         )
+        .arg(
+            Arg::new("blisscli")
+                .long("blisscli")
+                .help("Canonicalize with one blisscli process at PATH instead of labelg batches. \
+                       Bliss canonical forms differ from labelg's, so the graph files change and \
+                       --test no longer matches the geng references")
+                .value_name("PATH")
+                .required(false)
+        )
         .arg(
             Arg::new("geng")
                 .long("geng")
@@ -103,6 +112,10 @@ fn main() {
     let n_defect = *matches.get_one::<usize>("defect").expect("Invalid defect");
     let labelg_path = matches.get_one::<String>("labelg").map(|s| s.as_str()).unwrap();
     let geng_path = matches.get_one::<String>("geng").map(|s| s.as_str()).unwrap();
+    let canon = match matches.get_one::<String>("blisscli") {
+        Some(path) => Canonicalizer::Blisscli(path),
+        None => Canonicalizer::Labelg(labelg_path),
+    };
     
 
     if num_threads > 0 {
@@ -155,7 +168,7 @@ fn main() {
         if !nobuild {
             let start = std::time::Instant::now();
             println!("Generating graphs for {} loops and defect {}", n_loops, n_defect);
-            generate_graphs(n_loops, n_defect, labelg_path).unwrap();
+            generate_graphs(n_loops, n_defect, canon).unwrap();
             let duration = start.elapsed();
             println!("Time elapsed: {:?}", duration);
         }